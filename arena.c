@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+// Size of a normal block. Larger allocations get a block of their own.
+#define ARENA_BLOCK_SIZE 65536
+
+static struct arena_block* new_block(size_t size){
+/*
+Allocates an arena block with at least the given number of usable bytes.
+
+Receives: size_t size: Number of usable bytes needed.
+Returns: struct arena_block*: The new block.
+*/
+	struct arena_block* block;
+
+	if (size < ARENA_BLOCK_SIZE)
+		size = ARENA_BLOCK_SIZE;
+
+	block = malloc(sizeof(struct arena_block) + size);
+	block->next = NULL;
+	block->size = size;
+
+	return block;
+}
+
+void init_arena(struct arena* arena){
+/*
+Initializes an arena with one empty block.
+
+Receives: struct arena* arena: The arena to initialize.
+Returns: Nothing
+*/
+	arena->first = new_block(ARENA_BLOCK_SIZE);
+	arena->current = arena->first;
+	arena->used = 0;
+}
+
+void* arena_alloc(struct arena* arena, size_t size){
+/*
+Allocates memory from the arena, aligned for any type. If the current block
+is full, moves on to the next block kept from before the last reset, or
+adds a new block after the current one if that one is too small.
+
+Receives: -struct arena* arena: The arena.
+          -size_t size: Number of bytes needed.
+Returns: void*: The memory. Valid until the next arena_reset().
+*/
+	struct arena_block* block;
+	void* memory;
+
+	// Round up so the next allocation stays aligned.
+	size = (size + 15) & ~(size_t) 15;
+
+	if (arena->used + size > arena->current->size)
+	{
+		block = arena->current->next;
+		if (block == NULL || block->size < size)
+		{
+			block = new_block(size);
+			block->next = arena->current->next;
+			arena->current->next = block;
+		}
+		arena->current = block;
+		arena->used = 0;
+	}
+
+	memory = arena->current->data + arena->used;
+	arena->used += size;
+
+	return memory;
+}
+
+char* arena_strndup(struct arena* arena, const char* string, size_t length){
+/*
+Copies the first length chars of a string into the arena.
+
+Receives: -struct arena* arena: The arena.
+          -const char* string: The string to copy.
+          -size_t length: Number of chars to copy.
+Returns: char*: The null terminated copy.
+*/
+	char* copy = arena_alloc(arena, length + 1);
+
+	memcpy(copy, string, length);
+	copy[length] = '\0';
+
+	return copy;
+}
+
+void arena_reset(struct arena* arena){
+/*
+Releases everything allocated from the arena in constant time. The blocks
+stay linked so the next command reuses them.
+
+Receives: struct arena* arena: The arena.
+Returns: Nothing
+*/
+	arena->current = arena->first;
+	arena->used = 0;
+}
+
+void free_arena(struct arena* arena){
+/*
+Frees every block of an arena. The arena must be initialized again before
+it is used.
+
+Receives: struct arena* arena: The arena.
+Returns: Nothing
+*/
+	struct arena_block* block;
+
+	while ((block = arena->first) != NULL)
+	{
+		arena->first = block->next;
+		free(block);
+	}
+	arena->current = NULL;
+	arena->used = 0;
+}
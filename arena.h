@@ -0,0 +1,28 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+// Bump allocator for the memory of one command: the input line, its tokens
+// and its pipeline stages. Nothing is freed individually. arena_reset()
+// releases everything at once before the next command is read, and keeps
+// the blocks for reuse.
+struct arena_block {
+	struct arena_block* next;
+	size_t size;    // usable bytes in data
+	char data[];
+};
+
+struct arena {
+	struct arena_block* first;   // first block, where a reset arena starts
+	struct arena_block* current; // block allocations are taken from
+	size_t used;                 // bytes used in current
+};
+
+void init_arena(struct arena* arena);
+void* arena_alloc(struct arena* arena, size_t size);
+char* arena_strndup(struct arena* arena, const char* string, size_t length);
+void arena_reset(struct arena* arena);
+void free_arena(struct arena* arena);
+
+#endif // __ARENA_H__
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "batch.h"
+#include "job_runner.h"
+#include "command_info.h"
+#include "job_table.h"
+
+extern char** environ;
+
+// Room left in ARG_MAX for anything the kernel adds to the new process,
+// as xargs does.
+#define ARG_HEADROOM 2048
+
+// Exit value of batch if any command failed, as for xargs.
+#define BATCH_FAILED 123
+
+static long arg_size(char** args, int num_args){
+/*
+Returns the space a list of args takes in a new process: the strings and
+their pointers.
+
+Receives: -char** args: The args.
+          -int num_args: Number of args.
+Returns: long: The size in bytes.
+*/
+	long size = 0;
+	int i;
+
+	for (i = 0; i < num_args; i++)
+		size += strlen(args[i]) + 1 + sizeof(char*);
+
+	return size;
+}
+
+// What next_batch() needs to start each command.
+struct batch_items {
+	struct command_info* command;  // the batch command
+	char** fixed;                  // the command and the args every batch gets
+	int num_fixed;                 // number of fixed args
+	char** items;                  // the items
+	int num_items;                 // number of items
+	int next_item;                 // first item not started yet
+	long budget;                   // room for the items of each command
+	int started;                   // 1 once a command was started
+};
+
+static struct job* start_batch(struct job_table* jobs, struct command_info* command,
+	char** fixed, int num_fixed, char** items, int num_items){
+/*
+Starts one command with the fixed args followed by a batch of items.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct command_info* command: The batch command, for its
+           redirections.
+          -char** fixed: The command and the args every batch gets.
+          -int num_fixed: Number of fixed args.
+          -char** items: The args of this batch.
+          -int num_items: Number of items.
+Returns: struct job*: The new job, or NULL if it could not be started.
+*/
+	struct command_info batch = {0};
+	struct job* job;
+
+	batch.max_args = num_fixed + num_items + 1;
+	if ((batch.args = malloc(batch.max_args * sizeof(char*))) == NULL)
+	{
+		perror("malloc");
+		fflush(stdout);
+		return NULL;
+	}
+	memcpy(batch.args, fixed, num_fixed * sizeof(char*));
+	memcpy(batch.args + num_fixed, items, num_items * sizeof(char*));
+	batch.args[num_fixed + num_items] = NULL;
+
+	// Every batch reads the same stdin redirection. The output file was
+	// already opened as the shell's stdout.
+	batch.stdin_file = command->stdin_file;
+	batch.stdin_data = command->stdin_data;
+
+	// The fixed args can name process substitutions of the command.
+	batch.subst = command->subst;
+
+	job = start_quiet_job(jobs, &batch, 0);
+	free(batch.args);
+
+	return job;
+}
+
+static int next_batch(struct job_table* jobs, void* data, struct job** job){
+/*
+Starts the command for the next batch of items, for run_quiet_jobs().
+Every batch has at least one item, even one that is too large on its own.
+Without items, the command runs once with the fixed args.
+
+Receives: -struct job_table* jobs: The job table.
+          -void* data: The struct batch_items of the command.
+          -struct job** job: Set to the new job, or NULL.
+Returns: int: 0 once every item was given to a command, 1 otherwise.
+*/
+	struct batch_items* batch = data;
+	char** items = batch->items + batch->next_item;
+	long size = 0;
+	int batch_len;
+
+	if (batch->next_item == batch->num_items && batch->started)
+		return 0;
+
+	for (batch_len = 0; batch->next_item + batch_len < batch->num_items; batch_len++)
+	{
+		size += arg_size(&items[batch_len], 1);
+		if (size > batch->budget && batch_len > 0)
+			break;
+	}
+
+	*job = start_batch(jobs, batch->command, batch->fixed, batch->num_fixed, items, batch_len);
+	batch->next_item += batch_len;
+	batch->started = 1;
+	return 1;
+}
+
+int batch_command(struct job_table* jobs, struct command_info* command){
+/*
+Built in "batch" command: batch [-P N] command [args] [-- items]. Runs the
+command with the items as args, split into as many commands as needed so
+each one fits in ARG_MAX, like xargs. The args before "--" are given to
+every command, and the items are the args after it. Without "--", every arg
+after the command name is an item. With -P, up to N commands (at most
+MAX_JOBS) run at once. A > redirection applies to the output of all of
+them.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct command_info* command: The batch command.
+Returns: int: Termination status for the status builtin. The exit value is
+              123 if any command failed, 0 otherwise.
+*/
+	struct batch_items batch = {0};
+	char* count = NULL;
+	long size;
+	int max_jobs = 1;
+	int failed;
+	int i = 1;
+
+	// Options come before the command.
+	while (command->args[i] != NULL && command->args[i][0] == '-')
+	{
+		if (strcmp(command->args[i], "-P") == 0 && command->args[i + 1] != NULL)
+			count = command->args[++i];
+		else if (strncmp(command->args[i], "-P", 2) == 0 && command->args[i][2] != '\0')
+			count = command->args[i] + 2;
+		else
+			break;
+		i++;
+	}
+
+	if (count != NULL && (max_jobs = job_count(count)) == 0)
+	{
+		printf("batch: %s: number of commands must be 1 to %d\n", count, MAX_JOBS);
+		fflush(stdout);
+		return 2 << 8;
+	}
+
+	// There must be a command before "--".
+	if (command->args[i] == NULL || strcmp(command->args[i], "--") == 0)
+	{
+		printf("usage: batch [-P N] command [args] [-- items]\n");
+		fflush(stdout);
+		return 2 << 8;
+	}
+
+	// The fixed args end at "--", or after the command name.
+	batch.command = command;
+	batch.fixed = &command->args[i];
+	for (batch.num_fixed = 1; batch.fixed[batch.num_fixed] != NULL
+		&& strcmp(batch.fixed[batch.num_fixed], "--") != 0; batch.num_fixed++)
+		continue;
+	if (batch.fixed[batch.num_fixed] != NULL)
+		batch.items = batch.fixed + batch.num_fixed + 1;
+	else
+	{
+		batch.num_fixed = 1;
+		batch.items = batch.fixed + 1;
+	}
+	for (batch.num_items = 0; batch.items[batch.num_items] != NULL; batch.num_items++)
+		continue;
+
+	// Room for the items of each command: ARG_MAX less the environment,
+	// the fixed args and the NULL at the end.
+	batch.budget = sysconf(_SC_ARG_MAX) - ARG_HEADROOM - sizeof(char*)
+		- arg_size(batch.fixed, batch.num_fixed);
+	for (size = 0; environ[size] != NULL; size++)
+		continue;
+	batch.budget -= arg_size(environ, size) + sizeof(char*);
+
+	// All commands share one output file.
+	failed = run_quiet_jobs(jobs, command->stdout_file, max_jobs, next_batch, NULL, &batch);
+
+	// Returned in the format of a waitpid() status.
+	if (failed == -1)
+		return 1 << 8;
+	return failed ? BATCH_FAILED << 8 : 0;
+}
@@ -0,0 +1,9 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "job_table.h"
+#include "command_info.h"
+
+int batch_command(struct job_table* jobs, struct command_info* command);
+
+#endif // __BATCH_H__
@@ -0,0 +1,66 @@
+// Parser throughput benchmark. Runs tokenize() over a corpus of realistic
+// command lines and reports lines and megabytes parsed per second.
+//
+// Build and run from the repository root:
+//   gcc --std=gnu99 -O2 -I. -o parse_bench bench/parse_bench.c input_funcs.c scan.c arena.c
+//   ./parse_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "command_info.h"
+#include "input_funcs.h"
+#include "arena.h"
+
+static const char* corpus[] = {
+	"ls -la /var/log",
+	"grep -rn \"connection refused\" /var/log/app/*.log > /tmp/errors_$$.txt",
+	"sort -u < /tmp/input.txt | uniq -c | sort -rn | head -20",
+	"./gen_report --date 2021-02-03 --format csv --out report_$$.csv &",
+	"tar czf /backup/home_$$.tar.gz /home/user/projects",
+	"echo 'single quoted $$ stays' \"double quoted $$ expands\" plain\\ escaped",
+	"find . -name '*.c' -newer Makefile | xargs wc -l",
+	"curl -s -o /dev/null \"https://example.com/api?id=42&mode=full\"",
+	"python3 process.py --input data/batch_0001.json --workers 8 > out.log &",
+	"cat a.txt b.txt c.txt | tr A-Z a-z | sort | uniq > merged.txt",
+	"make -j8 all",
+	"awk -F, '{ sum += $3 } END { print sum }' < sales.csv",
+};
+
+int main(int argc, char** argv){
+	struct command_info command;
+	struct arena arena;
+	struct timespec start, end;
+	size_t num_lines = sizeof(corpus) / sizeof(corpus[0]);
+	size_t bytes = 0;
+	char* lines[sizeof(corpus) / sizeof(corpus[0])];
+	long iterations = (argc > 1) ? atol(argv[1]) : 1000000;
+	long i;
+	size_t j;
+	double seconds;
+
+	for (j = 0; j < num_lines; j++)
+	{
+		lines[j] = strdup(corpus[j]);
+		bytes += strlen(corpus[j]);
+	}
+
+	init_arena(&arena);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++)
+	{
+		arena_reset(&arena);
+		for (j = 0; j < num_lines; j++)
+			tokenize(lines[j], &command, &arena);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("parse lines=%ld seconds=%.3f lines_per_sec=%.0f mb_per_sec=%.1f\n",
+		iterations * (long) num_lines, seconds,
+		iterations * num_lines / seconds,
+		iterations * bytes / seconds / 1e6);
+
+	return 0;
+}
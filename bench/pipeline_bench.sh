@@ -0,0 +1,29 @@
+#!/bin/sh
+# Measures throughput through a 3-stage pipeline run natively by smallsh,
+# compared with the same pipeline wrapped in bash (the old workaround).
+#
+# Usage: bench/pipeline_bench.sh [smallsh binary] [megabytes]
+
+SMALLSH=${1:-./smallsh}
+MB=${2:-4096}
+BYTES=$((MB * 1024 * 1024))
+WRAPPER=$(mktemp)
+trap 'rm -f "$WRAPPER"' EXIT
+
+PIPELINE="head -c $BYTES /dev/zero | cat | cat > /dev/null"
+echo "$PIPELINE" > "$WRAPPER"
+
+# Prints the throughput of one run of smallsh with the given command line.
+run() {
+	name=$1
+	line=$2
+	start=$(date +%s%N)
+	printf '%s\nexit\n' "$line" | $SMALLSH > /dev/null
+	end=$(date +%s%N)
+	awk -v n="$name" -v b="$BYTES" -v ns=$((end - start)) \
+		'BEGIN { printf "%s %.3f GB/s\n", n, b / ns }'
+}
+
+run "native" "$PIPELINE"
+SMALLSH_PIPE_SIZE=1048576 run "native_1MB_pipes" "$PIPELINE"
+run "bash_wrapper" "bash $WRAPPER"
@@ -0,0 +1,102 @@
+// Line scanner benchmark. Tokenizes long generated command lines with each
+// scanner engine and reports the megabytes per second of the scan alone and
+// of the whole tokenize(). The byte engine marks every char, which is the
+// lexer's old per-byte path.
+//
+// Build and run from the repository root:
+//   gcc --std=gnu99 -O2 -I. -o scan_bench bench/scan_bench.c input_funcs.c scan.c arena.c
+//   ./scan_bench [line_length] [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "command_info.h"
+#include "input_funcs.h"
+#include "scan.h"
+#include "arena.h"
+
+// Words the generated lines are made of: plain args, paths, options,
+// quotes and "$$", as in a generated script.
+static const char* words[] = {
+	"--input=/data/shards/part-000017.json.gz",
+	"/usr/local/share/dataset/training/batch_$$.csv",
+	"--workers",
+	"16",
+	"'single quoted text with spaces'",
+	"\"double quoted $$ and more text\"",
+	"plain\\ escaped",
+	"--label=experiment-2021-02-03-run-0042",
+};
+
+static double elapsed(const struct timespec* start){
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char** argv){
+	const char* engines[] = {"byte", "scalar", "sse2", "avx2"};
+	size_t length = (argc > 1) ? strtoul(argv[1], NULL, 10) : 65536;
+	long iterations = (argc > 2) ? atol(argv[2]) : 2000;
+	struct command_info command;
+	struct timespec start;
+	struct arena arena;
+	uint64_t* bits;
+	char* line;
+	size_t used = 0;
+	size_t j = 0;
+	double scan_seconds;
+	double parse_seconds;
+	const char* engine;
+	long i;
+	int e;
+
+	// Build a line of about the requested length out of the words.
+	line = malloc(length + 64);
+	line[0] = '\0';
+	strcpy(line, "process");
+	used = strlen(line);
+	while (used + strlen(words[j]) + 1 < length)
+	{
+		line[used++] = ' ';
+		strcpy(line + used, words[j]);
+		used += strlen(words[j]);
+		j = (j + 1) % (sizeof(words) / sizeof(words[0]));
+	}
+	length = used;
+
+	bits = malloc(SCAN_WORDS(length) * sizeof(uint64_t));
+	init_arena(&arena);
+
+	for (e = 0; e < 4; e++)
+	{
+		// Engines the CPU does not have are skipped.
+		engine = select_scanner(engines[e]);
+		if (strcmp(engine, engines[e]) != 0)
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < iterations; i++)
+			scan_line(line, length, bits);
+		scan_seconds = elapsed(&start);
+
+		// tokenize() writes the words to the arena and leaves the line as
+		// it is, so the same line is parsed every time.
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < iterations; i++)
+		{
+			arena_reset(&arena);
+			tokenize(line, &command, &arena);
+		}
+		parse_seconds = elapsed(&start);
+
+		printf("engine=%s line_bytes=%zu scan_mb_per_sec=%.1f tokenize_mb_per_sec=%.1f\n",
+			engine, length, length * iterations / scan_seconds / 1e6,
+			length * iterations / parse_seconds / 1e6);
+	}
+
+	return 0;
+}
@@ -0,0 +1,46 @@
+#!/bin/sh
+# Long-run memory soak test. Feeds smallsh a large number of commands and
+# samples its resident set size while they run. Most lines are builtins with
+# $$ expansion and redirections, which exercise the parse path without
+# forking; every 1000th line launches a real process. Fails if RSS grows by
+# more than the allowed amount after the warm-up sample.
+#
+# Usage: bench/soak.sh [smallsh binary] [commands] [allowed growth in KB]
+
+SMALLSH=${1:-./smallsh}
+COUNT=${2:-1000000}
+ALLOWED_KB=${3:-512}
+
+awk -v n="$COUNT" 'BEGIN {
+	for (i = 0; i < n; i++) {
+		if (i % 1000 == 0)
+			print "true"
+		else if (i % 7 == 0)
+			print "# comment line " i
+		else
+			print "cd . arg$$" i " x$$y$$z < in_" i " > out_$$ &"
+	}
+	print "exit"
+}' | $SMALLSH > /dev/null &
+PID=$!
+
+first=""
+max=0
+last=0
+while kill -0 "$PID" 2> /dev/null; do
+	rss=$(awk '/^VmRSS:/ { print $2 }' /proc/"$PID"/status 2> /dev/null)
+	if [ -n "$rss" ]; then
+		[ -z "$first" ] && first=$rss
+		[ "$rss" -gt "$max" ] && max=$rss
+		last=$rss
+	fi
+	sleep 0.5
+done
+wait "$PID"
+
+echo "soak commands=$COUNT rss_first_kb=$first rss_max_kb=$max rss_last_kb=$last"
+if [ -n "$first" ] && [ $((max - first)) -gt "$ALLOWED_KB" ]; then
+	echo "soak FAILED: RSS grew by $((max - first)) KB"
+	exit 1
+fi
+echo "soak passed"
@@ -0,0 +1,298 @@
+// Spawn latency benchmark. Starts smallsh with its stdin and stdout connected
+// to pipes and drives it with fixed workloads, measuring the round trip of
+// every command: from writing the command line to seeing the next prompt.
+// Prints one JSON object per workload with the p50/p99/max latency and the
+// number of commands per second, so runs can be compared by a script.
+//
+// Workloads:
+//   true      N foreground "true" commands
+//   redirect  N foreground "cat < in > out" commands
+//   bg        N/10 "true &" commands. Latency is until "Background pid is"
+//             is printed. notice_* is the time from then until the shell
+//             reports the job as done, i.e. how fast completions are noticed.
+//
+// Build and run from the repository root (or use make bench):
+//   gcc --std=gnu99 -O2 -o spawn_bench bench/spawn_bench.c
+//   ./spawn_bench [smallsh binary] [N]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static int to_shell = -1;
+static int from_shell = -1;
+
+// Output of the shell that has been read but not yet matched.
+static char out_buf[65536];
+static size_t out_len = 0;
+
+static double now_us(void){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static pid_t start_shell(const char* smallsh){
+/*
+Starts smallsh with pipes for stdin and stdout.
+
+Receives: const char* smallsh: Path of the shell binary.
+Returns: pid_t: pid of the shell.
+*/
+	int in_pipe[2];
+	int out_pipe[2];
+	pid_t pid;
+
+	if (pipe(in_pipe) == -1 || pipe(out_pipe) == -1)
+	{
+		perror("pipe");
+		exit(1);
+	}
+
+	if ((pid = fork()) == 0)
+	{
+		dup2(in_pipe[0], 0);
+		dup2(out_pipe[1], 1);
+		close(in_pipe[0]);
+		close(in_pipe[1]);
+		close(out_pipe[0]);
+		close(out_pipe[1]);
+		execl(smallsh, smallsh, (char*) NULL);
+		perror(smallsh);
+		exit(127);
+	}
+
+	close(in_pipe[0]);
+	close(out_pipe[1]);
+	to_shell = in_pipe[1];
+	from_shell = out_pipe[0];
+	return pid;
+}
+
+static void send_line(const char* line){
+	size_t len = strlen(line);
+
+	if (write(to_shell, line, len) != (ssize_t) len)
+	{
+		perror("write");
+		exit(1);
+	}
+}
+
+static void fill_buffer(void){
+/*
+Reads more of the shell's output into out_buf. Exits if the shell is gone.
+*/
+	ssize_t num_read;
+
+	if (out_len == sizeof(out_buf))
+	{
+		fprintf(stderr, "output line too long\n");
+		exit(1);
+	}
+
+	num_read = read(from_shell, out_buf + out_len, sizeof(out_buf) - out_len);
+	if (num_read <= 0)
+	{
+		fprintf(stderr, "smallsh exited unexpectedly\n");
+		exit(1);
+	}
+	out_len += num_read;
+}
+
+static void consume(size_t used){
+	memmove(out_buf, out_buf + used, out_len - used);
+	out_len -= used;
+}
+
+static void wait_prompt(void){
+/*
+Reads the shell's output until the next prompt, and consumes it.
+*/
+	char* match;
+
+	while ((match = memmem(out_buf, out_len, ": ", 2)) == NULL)
+		fill_buffer();
+	consume(match + 2 - out_buf);
+}
+
+static void read_line(char* line, size_t size){
+/*
+Reads the next complete line of the shell's output, without its newline.
+Prompts are left at the start of the line they precede.
+*/
+	char* newline;
+	size_t len;
+
+	while ((newline = memchr(out_buf, '\n', out_len)) == NULL)
+		fill_buffer();
+
+	len = newline - out_buf;
+	if (len >= size)
+		len = size - 1;
+	memcpy(line, out_buf, len);
+	line[len] = '\0';
+	consume(newline + 1 - out_buf);
+}
+
+static int compare(const void* a, const void* b){
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile(double* sorted, int count, double p){
+	int i = (int) (p * (count - 1) + 0.5);
+
+	return sorted[i];
+}
+
+static void report(const char* name, double* latencies, int count, double elapsed_us,
+	double* notices, int num_notices){
+/*
+Prints the results of a workload as one JSON object.
+*/
+	qsort(latencies, count, sizeof(double), compare);
+	printf("{\"workload\":\"%s\",\"commands\":%d,\"seconds\":%.3f,\"cmds_per_sec\":%.0f,"
+		"\"p50_us\":%.1f,\"p99_us\":%.1f,\"max_us\":%.1f",
+		name, count, elapsed_us / 1e6, count / (elapsed_us / 1e6),
+		percentile(latencies, count, 0.5), percentile(latencies, count, 0.99),
+		latencies[count - 1]);
+
+	if (num_notices > 0)
+	{
+		qsort(notices, num_notices, sizeof(double), compare);
+		printf(",\"notice_p50_us\":%.1f,\"notice_p99_us\":%.1f,\"notice_max_us\":%.1f",
+			percentile(notices, num_notices, 0.5), percentile(notices, num_notices, 0.99),
+			notices[num_notices - 1]);
+	}
+	printf("}\n");
+	fflush(stdout);
+}
+
+static void run_foreground(const char* name, const char* line, int count){
+/*
+Runs a foreground workload. The commands print nothing, so every ": " in
+the output is the prompt that follows a command.
+*/
+	double* latencies = malloc(count * sizeof(double));
+	double start;
+	double begin;
+	int i;
+
+	begin = now_us();
+	for (i = 0; i < count; i++)
+	{
+		start = now_us();
+		send_line(line);
+		wait_prompt();
+		latencies[i] = now_us() - start;
+	}
+
+	report(name, latencies, count, now_us() - begin, NULL, 0);
+	free(latencies);
+}
+
+static void run_background(int count){
+/*
+Runs the background workload. Each "true &" is timed until the shell
+prints its pid. The completion reports are matched to their start times by
+pid, since they can arrive in any order and in between later commands.
+*/
+	double* latencies = malloc(count * sizeof(double));
+	double* notices = malloc(count * sizeof(double));
+	double* started = malloc(count * sizeof(double));
+	pid_t* pids = malloc(count * sizeof(pid_t));
+	char line[256];
+	char* match;
+	double start;
+	double begin;
+	pid_t pid;
+	int num_started = 0;
+	int num_notices = 0;
+	int i;
+
+	begin = now_us();
+	while (num_notices < count)
+	{
+		// Start the next job once the previous one has printed its pid.
+		if (num_started < count && (num_started == 0 || pids[num_started - 1] != 0))
+		{
+			start = now_us();
+			pids[num_started] = 0;
+			send_line("true &\n");
+			num_started++;
+		}
+
+		read_line(line, sizeof(line));
+
+		if ((match = strstr(line, "Background pid is ")) != NULL)
+		{
+			started[num_started - 1] = now_us();
+			latencies[num_started - 1] = started[num_started - 1] - start;
+			pids[num_started - 1] = atoi(match + 18);
+		}
+
+		else if ((match = strstr(line, "background pid ")) != NULL)
+		{
+			pid = atoi(match + 15);
+			for (i = 0; i < num_started && pids[i] != pid; i++)
+				continue;
+			if (i < num_started)
+				notices[num_notices++] = now_us() - started[i];
+		}
+	}
+
+	report("bg", latencies, count, now_us() - begin, notices, num_notices);
+	free(latencies);
+	free(notices);
+	free(started);
+	free(pids);
+}
+
+int main(int argc, char** argv){
+	const char* smallsh = (argc > 1) ? argv[1] : "./smallsh";
+	int count = (argc > 2) ? atoi(argv[2]) : 10000;
+	char in_path[] = "/tmp/spawn_bench_in_XXXXXX";
+	char line[256];
+	pid_t shell;
+	int fd;
+
+	if (count < 10)
+		count = 10;
+
+	// Input file for the redirect workload.
+	if ((fd = mkstemp(in_path)) == -1)
+	{
+		perror("mkstemp");
+		return 1;
+	}
+	write(fd, "spawn bench\n", 12);
+	close(fd);
+
+	signal(SIGPIPE, SIG_IGN);
+	shell = start_shell(smallsh);
+	wait_prompt();
+
+	run_foreground("true", "true\n", count);
+
+	snprintf(line, sizeof(line), "cat < %s > /dev/null\n", in_path);
+	run_foreground("redirect", line, count);
+
+	run_background(count / 10);
+
+	send_line("exit\n");
+	close(to_shell);
+	waitpid(shell, NULL, 0);
+	unlink(in_path);
+	return 0;
+}
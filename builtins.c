@@ -0,0 +1,804 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "builtins.h"
+#include "command_info.h"
+#include "spawn_engine.h"
+
+// In-process versions of small utilities that scripts run all the time,
+// so they don't cost a fork and exec: echo, true, false, pwd, test, [ and
+// printf. They are found through a perfect hash table, along with the
+// builtins that need the shell's state (cd, jobs, ...): the hash seed is
+// chosen at startup so that every name has its own slot, and a lookup is
+// one hash and one strcmp.
+
+// Size of the dispatch table, a power of two a few times the number of
+// builtins so a collision-free seed is found quickly.
+#define TABLE_SIZE 64
+
+static const struct builtin* table[TABLE_SIZE];
+static unsigned int seed = 0;
+static int table_ready = 0;
+
+/*
+echo, printf
+*/
+
+static int print_escape(const char** string, int echo_octal){
+/*
+Prints the escape sequence that starts at a backslash, and moves past it.
+
+Receives: -const char** string: Points to the backslash. Moved to the last
+           character of the sequence.
+          -int echo_octal: 1 for echo, where octal escapes are \0NNN, 0 for
+           printf, where they are \NNN.
+Returns: int: 1 if the sequence was \c, which ends all output, 0 otherwise.
+*/
+	const char* s = *string + 1;
+	int value = 0;
+	int digits = 0;
+
+	switch (*s)
+	{
+		case 'a': putchar('\a'); break;
+		case 'b': putchar('\b'); break;
+		case 'c': *string = s; return 1;
+		case 'e': putchar('\033'); break;
+		case 'f': putchar('\f'); break;
+		case 'n': putchar('\n'); break;
+		case 'r': putchar('\r'); break;
+		case 't': putchar('\t'); break;
+		case 'v': putchar('\v'); break;
+		case '\\': putchar('\\'); break;
+
+		case '\0':
+			// A backslash at the end is printed as is.
+			putchar('\\');
+			s--;
+			break;
+
+		default:
+			if (echo_octal ? *s == '0' : (*s >= '0' && *s <= '7'))
+			{
+				if (echo_octal)
+					s++;
+				for (; digits < 3 && *s >= '0' && *s <= '7'; digits++, s++)
+					value = value * 8 + (*s - '0');
+				putchar(value);
+				s--;
+			}
+			else
+			{
+				putchar('\\');
+				putchar(*s);
+			}
+			break;
+	}
+
+	*string = s;
+	return 0;
+}
+
+static int print_escaped(const char* string, int echo_octal){
+/*
+Prints a string, interpreting backslash escapes.
+
+Receives: -const char* string: The string.
+          -int echo_octal: See print_escape().
+Returns: int: 1 if output was ended by \c, 0 otherwise.
+*/
+	for (; *string != '\0'; string++)
+	{
+		if (*string != '\\')
+			putchar(*string);
+		else if (print_escape(&string, echo_octal))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int echo_builtin(char** args){
+/*
+echo [-neE] [string ...]: Prints its arguments separated by spaces. -n
+leaves out the newline, -e interprets backslash escapes, -E turns that off.
+*/
+	int newline = 1;
+	int escapes = 0;
+	int i = 1;
+	const char* option;
+
+	// Options are only recognized if every letter is one of n, e and E.
+	for (; args[i] != NULL && args[i][0] == '-' && args[i][1] != '\0'; i++)
+	{
+		if (strspn(args[i] + 1, "neE") != strlen(args[i] + 1))
+			break;
+		for (option = args[i] + 1; *option != '\0'; option++)
+		{
+			if (*option == 'n')
+				newline = 0;
+			else
+				escapes = (*option == 'e');
+		}
+	}
+
+	for (; args[i] != NULL; i++)
+	{
+		if (!escapes)
+			fputs(args[i], stdout);
+		else if (print_escaped(args[i], 1))
+			return 0;
+
+		if (args[i + 1] != NULL)
+			putchar(' ');
+	}
+
+	if (newline)
+		putchar('\n');
+	return 0;
+}
+
+static int numeric_arg(const char* arg, const char* end){
+/*
+Checks the result of converting a printf argument to a number, and prints
+an error if the whole argument was not used.
+
+Receives: -const char* arg: The argument.
+          -const char* end: Where the conversion stopped.
+Returns: int: 0 if the argument was valid, 1 otherwise.
+*/
+	if (*end == '\0' && errno == 0)
+		return 0;
+	fprintf(stderr, "printf: %s: invalid number\n", arg);
+	return 1;
+}
+
+static int print_format(const char* format, char*** args, int* status){
+/*
+Prints one pass of a printf format, taking the arguments its conversions
+use. Missing arguments are treated as empty strings or zero.
+
+Receives: -const char* format: The format.
+          -char*** args: The remaining arguments, moved past the ones used.
+          -int* status: Set to 1 if an argument or the format was invalid.
+Returns: int: 1 if output was ended by \c, 0 otherwise.
+*/
+	char spec[64];
+	const char* arg;
+	char* end;
+	size_t len;
+	char conversion;
+
+	for (; *format != '\0'; format++)
+	{
+		if (*format == '\\')
+		{
+			if (print_escape(&format, 0))
+				return 1;
+			continue;
+		}
+
+		if (*format != '%')
+		{
+			putchar(*format);
+			continue;
+		}
+
+		if (format[1] == '%')
+		{
+			putchar('%');
+			format++;
+			continue;
+		}
+
+		// Copy the flags, width and precision of the conversion.
+		len = 1 + strspn(format + 1, "-+ #0");
+		len += strspn(format + len, "0123456789");
+		if (format[len] == '.')
+			len += 1 + strspn(format + len + 1, "0123456789");
+		conversion = format[len];
+		if (len > sizeof(spec) - 4 || conversion == '\0')
+		{
+			fprintf(stderr, "printf: %s: invalid conversion\n", format);
+			*status = 1;
+			return 0;
+		}
+		memcpy(spec, format, len);
+		format += len;
+
+		arg = (**args != NULL) ? *(*args)++ : NULL;
+		errno = 0;
+
+		switch (conversion)
+		{
+			case 'd':
+			case 'i':
+				strcpy(spec + len, "lld");
+				if (arg != NULL && (*arg == '\'' || *arg == '"'))
+					printf(spec, (long long) (unsigned char) arg[1]);
+				else
+				{
+					printf(spec, arg ? strtoll(arg, &end, 0) : 0LL);
+					if (arg != NULL)
+						*status |= numeric_arg(arg, end);
+				}
+				break;
+
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+				sprintf(spec + len, "ll%c", conversion);
+				if (arg != NULL && (*arg == '\'' || *arg == '"'))
+					printf(spec, (unsigned long long) (unsigned char) arg[1]);
+				else
+				{
+					printf(spec, arg ? strtoull(arg, &end, 0) : 0ULL);
+					if (arg != NULL)
+						*status |= numeric_arg(arg, end);
+				}
+				break;
+
+			case 'f':
+			case 'F':
+			case 'e':
+			case 'E':
+			case 'g':
+			case 'G':
+			case 'a':
+			case 'A':
+				sprintf(spec + len, "%c", conversion);
+				printf(spec, arg ? strtod(arg, &end) : 0.0);
+				if (arg != NULL)
+					*status |= numeric_arg(arg, end);
+				break;
+
+			case 'c':
+				strcpy(spec + len, "c");
+				printf(spec, arg ? *arg : '\0');
+				break;
+
+			case 's':
+				strcpy(spec + len, "s");
+				printf(spec, arg ? arg : "");
+				break;
+
+			// %b prints the argument with its escapes interpreted.
+			case 'b':
+				if (arg != NULL && print_escaped(arg, 1))
+					return 1;
+				break;
+
+			default:
+				fprintf(stderr, "printf: %%%c: invalid conversion\n", conversion);
+				*status = 1;
+				return 0;
+		}
+	}
+
+	return 0;
+}
+
+static int printf_builtin(char** args){
+/*
+printf format [argument ...]: Prints the arguments according to the format.
+Like coreutils printf, the format is reused as long as arguments remain.
+*/
+	char** remaining;
+	char** before;
+	int status = 0;
+
+	if (args[1] == NULL)
+	{
+		fprintf(stderr, "printf: missing operand\n");
+		return 1;
+	}
+
+	remaining = args + 2;
+	do
+	{
+		before = remaining;
+		if (print_format(args[1], &remaining, &status))
+			break;
+	} while (*remaining != NULL && remaining != before && status == 0);
+
+	return status;
+}
+
+/*
+true, false, pwd
+*/
+
+static int true_builtin(char** args){
+	(void) args;
+	return 0;
+}
+
+static int false_builtin(char** args){
+	(void) args;
+	return 1;
+}
+
+static int pwd_builtin(char** args){
+/*
+pwd: Prints the current directory.
+*/
+	char* cwd;
+
+	(void) args;
+	if ((cwd = getcwd(NULL, 0)) == NULL)
+	{
+		perror("pwd");
+		return 1;
+	}
+
+	puts(cwd);
+	free(cwd);
+	return 0;
+}
+
+/*
+test, [
+*/
+
+// Arguments of the test expression being evaluated, from test_pos up to
+// test_end. test_error is set on a syntax error.
+static char** test_args;
+static int test_pos;
+static int test_end;
+static int test_error;
+
+static int test_or(void);
+
+static int is_binary_op(const char* op){
+	const char* ops[] = {"=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+		"-nt", "-ot", "-ef", NULL};
+	int i;
+
+	for (i = 0; ops[i] != NULL; i++)
+	{
+		if (strcmp(op, ops[i]) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static long long test_integer(const char* arg){
+/*
+Converts an operand of an integer comparison, flagging an error if it is
+not an integer.
+*/
+	char* end;
+	long long value;
+
+	errno = 0;
+	value = strtoll(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || errno != 0)
+	{
+		fprintf(stderr, "test: %s: integer expression expected\n", arg);
+		test_error = 1;
+	}
+	return value;
+}
+
+static int test_binary(const char* left, const char* op, const char* right){
+/*
+Evaluates a binary test: string comparison, integer comparison, or file
+age comparison.
+*/
+	struct stat left_info;
+	struct stat right_info;
+	int left_ok;
+	int right_ok;
+	long long a;
+	long long b;
+
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+		return strcmp(left, right) == 0;
+	if (strcmp(op, "!=") == 0)
+		return strcmp(left, right) != 0;
+
+	if (op[1] == 'n' || op[1] == 'o' || strcmp(op, "-ef") == 0)
+	{
+		left_ok = (stat(left, &left_info) == 0);
+		right_ok = (stat(right, &right_info) == 0);
+		if (strcmp(op, "-ef") == 0)
+			return left_ok && right_ok && left_info.st_dev == right_info.st_dev
+				&& left_info.st_ino == right_info.st_ino;
+
+		// A missing file is older than any existing one.
+		if (strcmp(op, "-nt") == 0)
+			return left_ok && (!right_ok || left_info.st_mtim.tv_sec > right_info.st_mtim.tv_sec
+				|| (left_info.st_mtim.tv_sec == right_info.st_mtim.tv_sec
+				&& left_info.st_mtim.tv_nsec > right_info.st_mtim.tv_nsec));
+		return right_ok && (!left_ok || left_info.st_mtim.tv_sec < right_info.st_mtim.tv_sec
+			|| (left_info.st_mtim.tv_sec == right_info.st_mtim.tv_sec
+			&& left_info.st_mtim.tv_nsec < right_info.st_mtim.tv_nsec));
+	}
+
+	a = test_integer(left);
+	b = test_integer(right);
+	if (strcmp(op, "-eq") == 0)
+		return a == b;
+	if (strcmp(op, "-ne") == 0)
+		return a != b;
+	if (strcmp(op, "-lt") == 0)
+		return a < b;
+	if (strcmp(op, "-le") == 0)
+		return a <= b;
+	if (strcmp(op, "-gt") == 0)
+		return a > b;
+	return a >= b;
+}
+
+static int test_unary(char op, const char* arg){
+/*
+Evaluates a unary test: a file test or a string length test. Returns -1 if
+op is not a unary operator.
+*/
+	struct stat info;
+
+	switch (op)
+	{
+		case 'n': return *arg != '\0';
+		case 'z': return *arg == '\0';
+		case 't': return isatty(atoi(arg));
+		case 'r': return access(arg, R_OK) == 0;
+		case 'w': return access(arg, W_OK) == 0;
+		case 'x': return access(arg, X_OK) == 0;
+		case 'L':
+		case 'h': return lstat(arg, &info) == 0 && S_ISLNK(info.st_mode);
+	}
+
+	if (strchr("efdspSbcgu", op) == NULL)
+		return -1;
+	if (stat(arg, &info) == -1)
+		return 0;
+
+	switch (op)
+	{
+		case 'e': return 1;
+		case 'f': return S_ISREG(info.st_mode);
+		case 'd': return S_ISDIR(info.st_mode);
+		case 's': return info.st_size > 0;
+		case 'p': return S_ISFIFO(info.st_mode);
+		case 'S': return S_ISSOCK(info.st_mode);
+		case 'b': return S_ISBLK(info.st_mode);
+		case 'c': return S_ISCHR(info.st_mode);
+		case 'g': return (info.st_mode & S_ISGID) != 0;
+		default:  return (info.st_mode & S_ISUID) != 0;
+	}
+}
+
+static int test_primary(void){
+/*
+primary: ( expr ) | unary-op arg | arg binary-op arg | arg
+A binary operator is checked for first, so "-n = -n" compares strings.
+*/
+	const char* arg;
+	int result;
+
+	if (test_pos >= test_end)
+	{
+		fprintf(stderr, "test: argument expected\n");
+		test_error = 1;
+		return 0;
+	}
+
+	arg = test_args[test_pos];
+
+	if (test_pos + 2 < test_end && is_binary_op(test_args[test_pos + 1]))
+	{
+		test_pos += 3;
+		return test_binary(arg, test_args[test_pos - 2], test_args[test_pos - 1]);
+	}
+
+	if (strcmp(arg, "(") == 0)
+	{
+		test_pos++;
+		result = test_or();
+		if (test_pos >= test_end || strcmp(test_args[test_pos], ")") != 0)
+		{
+			fprintf(stderr, "test: missing ')'\n");
+			test_error = 1;
+			return 0;
+		}
+		test_pos++;
+		return result;
+	}
+
+	if (arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0' && test_pos + 1 < test_end)
+	{
+		result = test_unary(arg[1], test_args[test_pos + 1]);
+		if (result != -1)
+		{
+			test_pos += 2;
+			return result;
+		}
+	}
+
+	// A single string is true if it is not empty.
+	test_pos++;
+	return *arg != '\0';
+}
+
+static int test_not(void){
+	if (test_pos < test_end && strcmp(test_args[test_pos], "!") == 0 && test_pos + 1 < test_end)
+	{
+		test_pos++;
+		return !test_not();
+	}
+	return test_primary();
+}
+
+static int test_and(void){
+	int result = test_not();
+
+	while (test_pos < test_end && strcmp(test_args[test_pos], "-a") == 0)
+	{
+		test_pos++;
+		result = test_not() && result;
+	}
+	return result;
+}
+
+static int test_or(void){
+	int result = test_and();
+
+	while (test_pos < test_end && strcmp(test_args[test_pos], "-o") == 0)
+	{
+		test_pos++;
+		result = test_and() || result;
+	}
+	return result;
+}
+
+static int test_builtin(char** args){
+/*
+test expression, [ expression ]: Evaluates a conditional expression.
+Returns 0 if it is true, 1 if it is false and 2 on a syntax error.
+*/
+	int result;
+
+	test_args = args;
+	test_pos = 1;
+	test_error = 0;
+	for (test_end = 1; args[test_end] != NULL; test_end++)
+		continue;
+
+	// [ needs a closing ], which is not part of the expression.
+	if (strcmp(args[0], "[") == 0)
+	{
+		if (strcmp(args[test_end - 1], "]") != 0 || test_end == 1)
+		{
+			fprintf(stderr, "[: missing ']'\n");
+			return 2;
+		}
+		test_end--;
+	}
+
+	// No expression is false.
+	if (test_pos == test_end)
+		return 1;
+
+	result = test_or();
+	if (test_pos != test_end && !test_error)
+	{
+		fprintf(stderr, "test: %s: unexpected argument\n", args[test_pos]);
+		test_error = 1;
+	}
+
+	if (test_error)
+		return 2;
+	return result ? 0 : 1;
+}
+
+/*
+Dispatch
+*/
+
+static const struct builtin builtins[] = {
+	{"echo", echo_builtin, SHELL_NONE, 0},
+	{"true", true_builtin, SHELL_NONE, 0},
+	{"false", false_builtin, SHELL_NONE, 0},
+	{"pwd", pwd_builtin, SHELL_NONE, 0},
+	{"test", test_builtin, SHELL_NONE, 0},
+	{"[", test_builtin, SHELL_NONE, 0},
+	{"printf", printf_builtin, SHELL_NONE, 0},
+
+	{"status", NULL, SHELL_STATUS, BUILTIN_SHELL},
+	{"cd", NULL, SHELL_CD, BUILTIN_SHELL},
+	{"exit", NULL, SHELL_EXIT, BUILTIN_SHELL},
+	{"jobs", NULL, SHELL_JOBS, BUILTIN_SHELL},
+	{"jobstat", NULL, SHELL_JOBSTAT, BUILTIN_SHELL},
+	{"fg", NULL, SHELL_FG, BUILTIN_SHELL},
+	{"kill", NULL, SHELL_KILL, BUILTIN_SHELL},
+	{"stats", NULL, SHELL_STATS, BUILTIN_SHELL},
+	{"hash", NULL, SHELL_HASH, BUILTIN_SHELL},
+	{"parallel", NULL, SHELL_PARALLEL, BUILTIN_SHELL},
+	{"batch", NULL, SHELL_BATCH, BUILTIN_SHELL},
+	{"cache", NULL, SHELL_CACHE, BUILTIN_SHELL | BUILTIN_PREFIX},
+	{"time", NULL, SHELL_TIME, BUILTIN_SHELL | BUILTIN_PREFIX},
+};
+
+#define NUM_BUILTINS (sizeof(builtins) / sizeof(builtins[0]))
+
+static unsigned int hash_name(const char* name, unsigned int hash_seed){
+/*
+FNV-1a hash of a builtin name, starting from a seed. The low bits of FNV-1a
+only depend on the low bits of its input, so the result is mixed before
+the table slot is taken from the low bits.
+
+Receives: -const char* name: The name.
+          -unsigned int hash_seed: The seed.
+Returns: unsigned int: The hash.
+*/
+	unsigned int hash = 2166136261u ^ hash_seed;
+
+	while (*name)
+	{
+		hash ^= (unsigned char) *name++;
+		hash *= 16777619u;
+	}
+
+	hash ^= hash >> 16;
+	hash *= 0x45d9f3bu;
+	hash ^= hash >> 16;
+	return hash;
+}
+
+void init_builtins(void){
+/*
+Builds the dispatch table. Tries seeds until every builtin hashes to its
+own slot, which takes a few dozen tries at most for this table size.
+Called once at startup, or by the first lookup.
+
+Receives: Nothing
+Returns: Nothing
+*/
+	unsigned int slot;
+	size_t i;
+
+	for (seed = 0; ; seed++)
+	{
+		memset(table, 0, sizeof(table));
+		for (i = 0; i < NUM_BUILTINS; i++)
+		{
+			slot = hash_name(builtins[i].name, seed) & (TABLE_SIZE - 1);
+			if (table[slot] != NULL)
+				break;
+			table[slot] = &builtins[i];
+		}
+
+		if (i == NUM_BUILTINS)
+		{
+			table_ready = 1;
+			return;
+		}
+	}
+}
+
+const struct builtin* find_builtin(const char* name){
+/*
+Looks up a builtin, either an in-process utility or a shell builtin.
+
+Receives: const char* name: The command name.
+Returns: const struct builtin*: The builtin, or NULL if there is none with
+                                that name.
+*/
+	const struct builtin* entry;
+
+	// smallsh_parse() can be called before a context is opened.
+	if (!table_ready)
+		init_builtins();
+
+	entry = table[hash_name(name, seed) & (TABLE_SIZE - 1)];
+	if (entry != NULL && strcmp(entry->name, name) == 0)
+		return entry;
+	return NULL;
+}
+
+const struct builtin* find_shell_builtin(const char* name, int pipeline){
+/*
+Looks up a builtin that runs in the shell itself. Most only do so for a
+command on its own, cache and time also for a pipeline, since they run the
+rest of it.
+
+Receives: -const char* name: Name of the pipeline's first command.
+          -int pipeline: 1 if the pipeline has more than one command.
+Returns: const struct builtin*: The builtin, or NULL if the pipeline is not
+                                run by a shell builtin.
+*/
+	const struct builtin* builtin = find_builtin(name);
+
+	if (builtin == NULL || !(builtin->flags & BUILTIN_SHELL))
+		return NULL;
+	if (pipeline && !(builtin->flags & BUILTIN_PREFIX))
+		return NULL;
+	return builtin;
+}
+
+static void restore_fd(int saved_fd, int fd){
+	if (saved_fd == -1)
+		return;
+	dup2(saved_fd, fd);
+	close(saved_fd);
+}
+
+int run_builtin(builtin_fn builtin, struct command_info* command){
+/*
+Runs an in-process builtin. Its < and > redirections are applied by
+temporarily pointing the shell's own stdin and stdout at the files, and
+restored afterwards.
+
+Receives: -builtin_fn builtin: The run function of an in-process builtin.
+          -struct command_info* command: The command.
+Returns: int: Termination status, in the format of a waitpid() status.
+*/
+	int saved_stdin = -1;
+	int saved_stdout = -1;
+	int exit_value;
+	int fd;
+
+	fflush(stdout);
+
+	if (command->stdin_file != NULL)
+	{
+		if ((fd = open(command->stdin_file, O_RDONLY | O_CLOEXEC)) == -1)
+		{
+			printf("Error opening file for stdin redirection\n");
+			fflush(stdout);
+			return W_EXITCODE(1, 0);
+		}
+		saved_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+		dup2(fd, STDIN_FILENO);
+		close(fd);
+	}
+
+	// A here-document or here-string is read from a pipe or memfd.
+	else if (command->stdin_data != NULL)
+	{
+		if ((fd = open_stdin_data(command->stdin_data)) == -1)
+			return W_EXITCODE(1, 0);
+		saved_stdin = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+		dup2(fd, STDIN_FILENO);
+		close(fd);
+	}
+
+	if (command->stdout_file != NULL)
+	{
+		fd = open(command->stdout_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+		if (fd == -1)
+		{
+			printf("open: %s: %s\n", command->stdout_file, strerror(errno));
+			fflush(stdout);
+			restore_fd(saved_stdin, STDIN_FILENO);
+			return W_EXITCODE(1, 0);
+		}
+		saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+
+	exit_value = builtin(command->args);
+
+	// Write out the builtin's output before stdout is switched back. A
+	// write that failed, such as to a pipe with no reader, fails the
+	// builtin.
+	if (fflush(stdout) == EOF || ferror(stdout))
+	{
+		clearerr(stdout);
+		if (exit_value == 0)
+			exit_value = 1;
+	}
+	restore_fd(saved_stdout, STDOUT_FILENO);
+	restore_fd(saved_stdin, STDIN_FILENO);
+
+	return W_EXITCODE(exit_value, 0);
+}
@@ -0,0 +1,46 @@
+#ifndef __BUILTINS_H__
+#define __BUILTINS_H__
+
+#include "command_info.h"
+
+// In-process version of a utility. Receives the command's arguments and
+// returns its exit value.
+typedef int (*builtin_fn)(char** args);
+
+// Builtins that need the shell's state (its job table, last status, ...).
+// run_command() runs them itself, switching on the id.
+enum shell_builtin {
+	SHELL_NONE,
+	SHELL_STATUS,
+	SHELL_CD,
+	SHELL_EXIT,
+	SHELL_JOBS,
+	SHELL_JOBSTAT,
+	SHELL_FG,
+	SHELL_KILL,
+	SHELL_STATS,
+	SHELL_HASH,
+	SHELL_PARALLEL,
+	SHELL_BATCH,
+	SHELL_CACHE,
+	SHELL_TIME
+};
+
+// Flags of a builtin.
+#define BUILTIN_SHELL  1 // needs the shell's state, so it never runs as a program
+#define BUILTIN_PREFIX 2 // runs the rest of the pipeline, so it is not
+                         // limited to a command on its own
+
+struct builtin {
+	const char* name;
+	builtin_fn run;          // in-process utility, NULL for a shell builtin
+	enum shell_builtin id;   // SHELL_NONE for an in-process utility
+	int flags;
+};
+
+void init_builtins(void);
+const struct builtin* find_builtin(const char* name);
+const struct builtin* find_shell_builtin(const char* name, int pipeline);
+int run_builtin(builtin_fn builtin, struct command_info* command);
+
+#endif // __BUILTINS_H__
@@ -0,0 +1,602 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include "cache.h"
+#include "command_info.h"
+#include "shell_process.h"
+#include "path_cache.h"
+#include "sha256.h"
+
+// The cache has two parts in its directory. keys/ maps the digest of a
+// command's inputs to its exit status and the digest of its output, and
+// objects/ holds each output once, named by the digest of its contents.
+// Commands with the same output share one object. A key's mtime is its last
+// use, and the least recently used keys are evicted when the objects take
+// more than the size limit.
+
+// Size limit of the objects, unless SMALLSH_CACHE_SIZE is set.
+#define DEFAULT_CACHE_SIZE (64L << 20)
+
+// Length of a digest in hex, without the null byte.
+#define DIGEST_LEN 64
+
+// Stores between two scans of the cache directory when the objects are
+// under the limit, to pick up objects stored by other shells.
+#define RESCAN_STORES 64
+
+// A key or an object found while evicting.
+struct entry {
+	char name[DIGEST_LEN + 1];
+	char object[DIGEST_LEN + 1]; // for a key, the object it refers to
+	struct timespec used;        // for a key, its last use
+	off_t size;                  // for an object, its size
+	int refs;                    // for an object, keys that refer to it
+};
+
+// Counters since the shell started, printed by cache stats.
+static struct {
+	long hits;
+	long misses;
+	long stores;
+	long evictions;
+} counters;
+
+// Size of the objects at the last scan plus the objects stored since, so a
+// store only scans the directory when the limit may have been passed. -1
+// until the first scan.
+static long known_size = -1;
+static int stores_since_scan = 0;
+
+static void add_string(struct sha256* digest, const char* string){
+/*
+Adds a string to a digest, with its null byte, so "ab" "c" and "a" "bc"
+give different digests.
+
+Receives: -struct sha256* digest: The digest.
+          -const char* string: The string.
+Returns: Nothing
+*/
+	sha256_update(digest, string, strlen(string) + 1);
+}
+
+static void add_file(struct sha256* digest, const char* path){
+/*
+Adds the identity of a file to a digest: its path, device, inode, size and
+mtime. A file that does not exist is added as missing.
+
+Receives: -struct sha256* digest: The digest.
+          -const char* path: The file.
+Returns: Nothing
+*/
+	struct stat info;
+
+	add_string(digest, path);
+	if (stat(path, &info) == -1)
+	{
+		add_string(digest, "(missing)");
+		return;
+	}
+	sha256_update(digest, &info.st_dev, sizeof(info.st_dev));
+	sha256_update(digest, &info.st_ino, sizeof(info.st_ino));
+	sha256_update(digest, &info.st_size, sizeof(info.st_size));
+	sha256_update(digest, &info.st_mtim, sizeof(info.st_mtim));
+}
+
+static void digest_hex(struct sha256* digest, char* hex){
+/*
+Finishes a digest and writes it as hex.
+
+Receives: -struct sha256* digest: The digest.
+          -char* hex: Filled with DIGEST_LEN hex chars and a null byte.
+Returns: Nothing
+*/
+	unsigned char bytes[32];
+	int i;
+
+	sha256_final(digest, bytes);
+	for (i = 0; i < 32; i++)
+		sprintf(hex + i * 2, "%02x", bytes[i]);
+}
+
+static const char* cache_dir(void){
+/*
+Returns the cache directory, creating it and its keys/ and objects/
+subdirectories if needed: $SMALLSH_CACHE_DIR, or smallsh in
+$XDG_CACHE_HOME or ~/.cache.
+
+Receives: Nothing
+Returns: const char*: The directory, or NULL if it could not be created.
+*/
+	static char dir[4096] = "";
+	char path[4200];
+	const char* base;
+	char* slash;
+
+	if (dir[0] != '\0')
+		return dir;
+
+	if ((base = getenv("SMALLSH_CACHE_DIR")) != NULL)
+		snprintf(dir, sizeof(dir), "%s", base);
+	else if ((base = getenv("XDG_CACHE_HOME")) != NULL)
+		snprintf(dir, sizeof(dir), "%s/smallsh", base);
+	else
+		snprintf(dir, sizeof(dir), "%s/.cache/smallsh", getenv("HOME") ? getenv("HOME") : ".");
+
+	// Create every missing directory of the path.
+	snprintf(path, sizeof(path), "%s/keys", dir);
+	for (slash = strchr(path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+	{
+		*slash = '\0';
+		mkdir(path, 0700);
+		*slash = '/';
+	}
+	mkdir(path, 0700);
+	snprintf(path, sizeof(path), "%s/objects", dir);
+	if (mkdir(path, 0700) == -1 && errno != EEXIST)
+	{
+		perror(path);
+		fflush(stdout);
+		dir[0] = '\0';
+		return NULL;
+	}
+
+	return dir;
+}
+
+static long cache_limit(void){
+/*
+Returns the size limit of the cache's objects, from SMALLSH_CACHE_SIZE (in
+bytes) if set.
+
+Receives: Nothing
+Returns: long: The limit in bytes.
+*/
+	const char* size = getenv("SMALLSH_CACHE_SIZE");
+
+	if (size != NULL && atol(size) > 0)
+		return atol(size);
+	return DEFAULT_CACHE_SIZE;
+}
+
+static int copy_fd(int from, int to){
+/*
+Copies everything that is left in one fd to another.
+
+Receives: -int from: Where to read.
+          -int to: Where to write.
+Returns: int: 0 if successful, -1 on an error.
+*/
+	char buffer[65536];
+	ssize_t num_read;
+	ssize_t written;
+	ssize_t result;
+
+	while ((num_read = read(from, buffer, sizeof(buffer))) > 0)
+	{
+		for (written = 0; written < num_read; written += result)
+		{
+			if ((result = write(to, buffer + written, num_read - written)) == -1)
+				return -1;
+		}
+	}
+
+	return (num_read == -1) ? -1 : 0;
+}
+
+static int replay(const char* object, const char* stdout_file){
+/*
+Writes a stored output to the command's stdout: its > file, or the
+shell's stdout.
+
+Receives: -const char* object: Path of the object.
+          -const char* stdout_file: The command's > file, or NULL.
+Returns: int: 0 if successful, -1 if a file could not be opened.
+*/
+	int in;
+	int out = STDOUT_FILENO;
+	int result;
+
+	if ((in = open(object, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+
+	if (stdout_file != NULL
+		&& (out = open(stdout_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660)) == -1)
+	{
+		perror("open");
+		fflush(stdout);
+		close(in);
+		return -1;
+	}
+
+	fflush(stdout);
+	result = copy_fd(in, out);
+	close(in);
+	if (out != STDOUT_FILENO)
+		close(out);
+	return result;
+}
+
+static int compare_objects(const void* left, const void* right){
+	return strcmp(((const struct entry*) left)->name, ((const struct entry*) right)->name);
+}
+
+static int compare_used(const void* left, const void* right){
+	const struct entry* a = left;
+	const struct entry* b = right;
+
+	if (a->used.tv_sec != b->used.tv_sec)
+		return (a->used.tv_sec < b->used.tv_sec) ? -1 : 1;
+	if (a->used.tv_nsec != b->used.tv_nsec)
+		return (a->used.tv_nsec < b->used.tv_nsec) ? -1 : 1;
+	return 0;
+}
+
+static struct entry* scan(const char* dir, const char* sub, int* count){
+/*
+Lists the keys or objects of the cache. A key's object is read from the
+key file.
+
+Receives: -const char* dir: The cache directory.
+          -const char* sub: "keys" or "objects".
+          -int* count: Set to the number of entries.
+Returns: struct entry*: The entries, allocated.
+*/
+	struct entry* entries = NULL;
+	struct dirent* dirent;
+	struct stat info;
+	char path[4200];
+	int capacity = 0;
+	int status;
+	DIR* stream;
+	FILE* file;
+
+	*count = 0;
+	snprintf(path, sizeof(path), "%s/%s", dir, sub);
+	if ((stream = opendir(path)) == NULL)
+		return NULL;
+
+	while ((dirent = readdir(stream)) != NULL)
+	{
+		if (strlen(dirent->d_name) != DIGEST_LEN)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s/%s", dir, sub, dirent->d_name);
+		if (stat(path, &info) == -1)
+			continue;
+
+		if (*count == capacity)
+		{
+			capacity = capacity ? capacity * 2 : 64;
+			entries = realloc(entries, capacity * sizeof(struct entry));
+		}
+		strcpy(entries[*count].name, dirent->d_name);
+		entries[*count].object[0] = '\0';
+		entries[*count].used = info.st_mtim;
+		entries[*count].size = info.st_size;
+		entries[*count].refs = 0;
+
+		if (strcmp(sub, "keys") == 0 && (file = fopen(path, "r")) != NULL)
+		{
+			if (fscanf(file, "%d %64s", &status, entries[*count].object) != 2)
+				entries[*count].object[0] = '\0';
+			fclose(file);
+		}
+		(*count)++;
+	}
+
+	closedir(stream);
+	return entries;
+}
+
+static void evict(const char* dir, long limit, long* total_size, int* num_keys){
+/*
+Removes the least recently used keys until the objects fit in the limit.
+An object is removed with the last key that refers to it. Objects that no
+key refers to are always removed.
+
+Receives: -const char* dir: The cache directory.
+          -long limit: Size limit of the objects, in bytes. -1 to only count.
+          -long* total_size: Set to the size of the objects that are left.
+          -int* num_keys: Set to the number of keys that are left.
+Returns: Nothing
+*/
+	struct entry* keys;
+	struct entry* objects;
+	struct entry* object;
+	char path[4200];
+	int num_objects;
+	int i;
+
+	keys = scan(dir, "keys", num_keys);
+	objects = scan(dir, "objects", &num_objects);
+	if (num_objects > 0)
+		qsort(objects, num_objects, sizeof(struct entry), compare_objects);
+
+	for (i = 0; i < *num_keys; i++)
+	{
+		object = (num_objects > 0) ? bsearch(keys[i].object, objects, num_objects,
+			sizeof(struct entry), compare_objects) : NULL;
+		if (object != NULL)
+			object->refs++;
+	}
+
+	*total_size = 0;
+	for (i = 0; i < num_objects; i++)
+	{
+		if (objects[i].refs == 0 && limit != -1)
+		{
+			snprintf(path, sizeof(path), "%s/objects/%s", dir, objects[i].name);
+			unlink(path);
+		}
+		else
+			*total_size += objects[i].size;
+	}
+
+	// Oldest keys first.
+	if (limit != -1 && *total_size > limit && *num_keys > 0)
+	{
+		qsort(keys, *num_keys, sizeof(struct entry), compare_used);
+		for (i = 0; i < *num_keys && *total_size > limit; i++)
+		{
+			snprintf(path, sizeof(path), "%s/keys/%s", dir, keys[i].name);
+			unlink(path);
+			counters.evictions++;
+
+			object = (num_objects > 0) ? bsearch(keys[i].object, objects, num_objects,
+				sizeof(struct entry), compare_objects) : NULL;
+			if (object != NULL && --object->refs == 0)
+			{
+				snprintf(path, sizeof(path), "%s/objects/%s", dir, object->name);
+				unlink(path);
+				*total_size -= object->size;
+			}
+		}
+		*num_keys -= i;
+	}
+
+	free(keys);
+	free(objects);
+}
+
+static int store(const char* dir, const char* key, const char* output, int wstatus, off_t* added){
+/*
+Stores the output of a command that was just run. The output file is
+renamed to its object, unless the same output is already stored, and the
+key is written to a temporary file and renamed, so readers never see a
+partial key.
+
+Receives: -const char* dir: The cache directory.
+          -const char* key: Digest of the command's inputs.
+          -const char* output: File holding the command's stdout.
+          -int wstatus: Termination status of the command.
+          -off_t* added: Set to the size of the new object, 0 if the output
+           was already stored.
+Returns: int: 0 if successful, -1 otherwise.
+*/
+	struct sha256 digest;
+	struct stat info;
+	char object[DIGEST_LEN + 1];
+	char path[4200];
+	char temp[4200];
+	char buffer[65536];
+	ssize_t num_read;
+	FILE* file;
+	int fd;
+
+	*added = 0;
+	if ((fd = open(output, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
+	fstat(fd, &info);
+	sha256_init(&digest);
+	while ((num_read = read(fd, buffer, sizeof(buffer))) > 0)
+		sha256_update(&digest, buffer, num_read);
+	close(fd);
+	digest_hex(&digest, object);
+
+	snprintf(path, sizeof(path), "%s/objects/%s", dir, object);
+	if (access(path, F_OK) == 0)
+		unlink(output);
+	else if (rename(output, path) == -1)
+		return -1;
+	else
+		*added = info.st_size;
+
+	snprintf(temp, sizeof(temp), "%s/keys/tmp.%d", dir, (int) getpid());
+	snprintf(path, sizeof(path), "%s/keys/%s", dir, key);
+	if ((file = fopen(temp, "w")) == NULL)
+		return -1;
+	fprintf(file, "%d %s\n", wstatus, object);
+	if (fclose(file) != 0 || rename(temp, path) == -1)
+	{
+		unlink(temp);
+		return -1;
+	}
+
+	counters.stores++;
+	return 0;
+}
+
+static void store_done(const char* dir, off_t added){
+/*
+Evicts after a store if the objects may be over the limit, going by the
+size kept since the last scan, or if RESCAN_STORES stores were made since.
+Otherwise the directory is not scanned.
+
+Receives: -const char* dir: The cache directory.
+          -off_t added: Size of the object the store created, 0 if none.
+Returns: Nothing
+*/
+	long limit = cache_limit();
+	int num_keys;
+
+	if (known_size != -1)
+		known_size += added;
+	if (known_size != -1 && known_size <= limit && ++stores_since_scan < RESCAN_STORES)
+		return;
+
+	evict(dir, limit, &known_size, &num_keys);
+	stores_since_scan = 0;
+}
+
+static void cache_stats(void){
+/*
+Prints the cache's counters since the shell started and the size of the
+store on disk.
+
+Receives: Nothing
+Returns: Nothing
+*/
+	const char* dir = cache_dir();
+	long total_size = 0;
+	int num_keys = 0;
+
+	if (dir != NULL)
+		evict(dir, -1, &total_size, &num_keys);
+
+	printf("hits %ld\nmisses %ld\nstores %ld\nevictions %ld\n",
+		counters.hits, counters.misses, counters.stores, counters.evictions);
+	printf("entries %d\nbytes %ld\nlimit %ld\ndirectory %s\n",
+		num_keys, total_size, cache_limit(), dir ? dir : "(none)");
+	fflush(stdout);
+}
+
+int cache_command(struct command_info* command){
+/*
+Built in "cache" prefix: cache [-a] [-i file]... command [args], or cache
+stats. Runs a deterministic command, or replays its stdout and exit status
+if it already ran with the same inputs. The prefix covers the whole
+pipeline: cache a | b stores the output of b, keyed on both commands. It
+runs in the foreground, so & is a usage error. The inputs are the args and
+the program found on PATH (by path, inode, size and mtime) of every
+command of the pipeline, the working directory, the < file (the same
+way), a here-document's contents and every file given with -i. The output is captured to a file while the command runs, so it is
+only shown once the command is done. Only an exit value of 0 is stored,
+or any exit value with -a. Commands terminated by a signal, and commands
+that could not be started (not found, or a failed redirection), are never
+stored, so their errors are shown every time.
+
+Receives: struct command_info* command: The command, starting with "cache".
+Returns: int: Termination status for the status builtin.
+*/
+	struct command_info cached;
+	struct command_info* stage;
+	struct command_info* last;
+	struct sha256 digest;
+	char key[DIGEST_LEN + 1];
+	char key_path[4200];
+	char object_path[4200];
+	char output[4200];
+	char cwd[4096];
+	char* stdout_file;
+	const char* dir;
+	off_t added;
+	const char* path;
+	int all_status = 0;
+	int runnable = 1;
+	int wstatus;
+	int i = 1;
+	FILE* file;
+
+	if (command->args[1] != NULL && strcmp(command->args[1], "stats") == 0 && command->args[2] == NULL)
+	{
+		cache_stats();
+		return 0;
+	}
+
+	// The options and declared input files come before the command.
+	sha256_init(&digest);
+	while (command->args[i] != NULL)
+	{
+		if (strcmp(command->args[i], "-a") == 0)
+			all_status = 1;
+		else if (strcmp(command->args[i], "-i") == 0 && command->args[i + 1] != NULL)
+			add_file(&digest, command->args[++i]);
+		else
+			break;
+		i++;
+	}
+
+	if (command->args[i] == NULL || command->background)
+	{
+		printf("usage: cache [-a] [-i file]... command [args] | cache stats\n");
+		fflush(stdout);
+		return W_EXITCODE(2, 0);
+	}
+
+	// Run a copy of the command whose args start after "cache" and the
+	// options, so the command itself is unchanged and can run again.
+	cached = *command;
+	cached.args = command->args + i;
+	cached.max_args -= i;
+	command = &cached;
+
+	if (getcwd(cwd, sizeof(cwd)) != NULL)
+		add_string(&digest, cwd);
+	for (stage = command; stage != NULL; stage = stage->next_stage)
+	{
+		add_string(&digest, "|");
+		for (i = 0; stage->args[i] != NULL; i++)
+			add_string(&digest, stage->args[i]);
+		if (stage->stdin_file != NULL)
+			add_file(&digest, stage->stdin_file);
+		if (stage->stdin_data != NULL)
+			add_string(&digest, stage->stdin_data);
+		last = stage;
+
+		// The program itself is an input, so replacing it on PATH runs it
+		// again. The fork and zygote engines only find out in the child
+		// that a program does not exist, so check before running.
+		path = lookup_command(stage->args[0]);
+		if (path == NULL || access(path, X_OK) == -1)
+			runnable = 0;
+		else
+			add_file(&digest, path);
+	}
+	digest_hex(&digest, key);
+
+	// Without a cache directory, or for a command that can't run, the
+	// command just runs, and reports its error.
+	if ((dir = cache_dir()) == NULL || !runnable)
+		return fg_proc(command);
+
+	// A hit replays the output and status, and marks the key as used.
+	snprintf(key_path, sizeof(key_path), "%s/keys/%s", dir, key);
+	if ((file = fopen(key_path, "r")) != NULL)
+	{
+		strcpy(object_path, dir);
+		strcat(object_path, "/objects/");
+		i = fscanf(file, "%d %64s", &wstatus, object_path + strlen(object_path));
+		fclose(file);
+		if (i == 2 && replay(object_path, last->stdout_file) == 0)
+		{
+			utimensat(AT_FDCWD, key_path, NULL, 0);
+			counters.hits++;
+			return wstatus;
+		}
+	}
+	counters.misses++;
+
+	// Capture the last command's stdout, then write it where it was going.
+	snprintf(output, sizeof(output), "%s/objects/tmp.%d", dir, (int) getpid());
+	stdout_file = last->stdout_file;
+	last->stdout_file = output;
+	wstatus = fg_proc(command);
+	last->stdout_file = stdout_file;
+
+	replay(output, stdout_file);
+	if (wstatus != -1 && !fg_spawn_failed() && WIFEXITED(wstatus)
+		&& (all_status || WEXITSTATUS(wstatus) == 0) && store(dir, key, output, wstatus, &added) == 0)
+		store_done(dir, added);
+	else
+		unlink(output);
+
+	return wstatus;
+}
@@ -0,0 +1,8 @@
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include "command_info.h"
+
+int cache_command(struct command_info* command);
+
+#endif // __CACHE_H__
@@ -1,16 +1,59 @@
 #ifndef __COMMAND_INFO_H__
 #define __COMMAND_INFO_H__
 
+struct placement;
+struct proc_subst;
+
+// Operator after a pipeline in a command list such as "a && b || c ; d".
+// "&&" and "||" have the same precedence and group to the left, so the list
+// is kept as a chain of pipelines and run from left to right.
+enum list_op {
+	LIST_END,  // last pipeline of the list
+	LIST_SEQ,  // ";"  the next pipeline always runs
+	LIST_AND,  // "&&" the next pipeline runs if this one succeeded
+	LIST_OR    // "||" the next pipeline runs if this one failed
+};
+
 struct command_info{
-	char* args[512]; // Array of char pointers. Will hold pointers to args.
+	char** args; // Array of char pointers. Will hold pointers to args,
+	             // followed by NULL. Allocated in the command's arena.
+
+	int max_args; // Number of entries args has room for, including the
+	              // NULL. Grown by tokenize() as needed.
 
 	char* stdin_file; // If no change to stdin, this is NULL. If change it 
 	                  // holds pointer to path of file.
 
+	char* stdin_data; // Contents of a here-document (<<WORD) or here-string
+	                  // (<<<word) given as stdin, NULL if none.
+
+	char* heredoc_end; // Word that ends the here-document, NULL if there is
+	                   // none. The body is read by read_heredocs().
+
 	char* stdout_file; // If no change to stdout, this is NULL. If change it
 	                   // holds pointer to path of file.
 	
+	struct proc_subst* subst; // Process substitutions, <(cmd) and >(cmd),
+	                          // in the words of this command. NULL if none.
+
 	int background; // If to be run in fg, this is 0. If bg, this is 1. 
+	                // Only set on the first command of a pipeline.
+
+	struct placement* placement; // CPU and priority prefix (pin, nice, ...),
+	                             // NULL if none. Only set on the first
+	                             // command of a pipeline.
+
+	struct command_info* next_stage; // Next command of a pipeline, whose
+	                                 // stdin is this command's stdout.
+	                                 // NULL if this is the last command.
+
+	enum list_op next_op; // Operator after this pipeline in the command
+	                      // list. Only set on the first command of a
+	                      // pipeline.
+
+	struct command_info* next_command; // First command of the next pipeline
+	                                   // of the list, NULL if next_op is
+	                                   // LIST_END.
 };
 
 #endif
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include "event_loop.h"
+#include "shell_process.h"
+#include "job_table.h"
+
+// The event loop waits on stdin, a signalfd for SIGCHLD and one pidfd per
+// background process with a single epoll instance. Each pidfd is registered
+// with its job id and process index, so a completed process is found
+// without searching.
+static int epoll_fd = -1;
+static int sigchld_fd = -1;
+
+// Set if stdin cannot be watched with epoll (e.g. a regular file), in which
+// case it is treated as always readable.
+static int stdin_always_ready = 0;
+
+// Set if stdin is in the epoll set, and while a builtin has paused input
+// with watch_input().
+static int stdin_watched = 0;
+static int input_paused = 0;
+
+// Number of background processes that could not get a pidfd. These are only
+// checked when a SIGCHLD arrives.
+static int unwatched_bg = 0;
+
+// Epoll data of the two fixed descriptors. Pidfds use their job id in the
+// upper 32 bits, which is always at least 1, and the index of the process
+// in the job in the lower 32 bits.
+#define STDIN_EVENT 0
+#define SIGCHLD_EVENT ((uint64_t) -1)
+
+int init_events(int watch_stdin){
+/*
+Creates the epoll instance and the SIGCHLD signalfd, and starts watching
+stdin. SIGCHLD is blocked so that it is only delivered through the
+signalfd. Called once, when the first context is opened.
+
+Receives: int watch_stdin: 1 to watch stdin for input, 0 if the shell
+                           reads a script and never waits for input.
+Returns: int: 0 if successful, -1 with errno set if the epoll instance
+              could not be created, in which case nothing was changed.
+*/
+	struct epoll_event event = {0};
+	sigset_t sigchld_set;
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd == -1)
+		return -1;
+
+	// Block SIGCHLD and receive it through a signalfd instead.
+	sigemptyset(&sigchld_set);
+	sigaddset(&sigchld_set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &sigchld_set, NULL);
+	sigchld_fd = signalfd(-1, &sigchld_set, SFD_NONBLOCK | SFD_CLOEXEC);
+
+	event.events = EPOLLIN;
+	event.data.u64 = SIGCHLD_EVENT;
+	if (sigchld_fd != -1)
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sigchld_fd, &event);
+
+	// epoll refuses regular files with EPERM. Those are always readable.
+	event.data.u64 = STDIN_EVENT;
+	if (watch_stdin && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) == -1)
+		stdin_always_ready = 1;
+	else if (watch_stdin)
+		stdin_watched = 1;
+	return 0;
+}
+
+void watch_input(int watch){
+/*
+Pauses or resumes watching stdin. A builtin that waits for its own jobs
+(parallel) pauses input, so pending input does not wake up wait_events()
+until it returns to the prompt.
+
+Receives: int watch: 0 to pause, 1 to resume.
+Returns: Nothing
+*/
+	struct epoll_event event = {0};
+
+	input_paused = !watch;
+	if (!stdin_watched)
+		return;
+
+	event.events = EPOLLIN;
+	event.data.u64 = STDIN_EVENT;
+	if (watch)
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event);
+	else
+		epoll_ctl(epoll_fd, EPOLL_CTL_DEL, STDIN_FILENO, NULL);
+}
+
+void watch_bg(struct job* job, int proc){
+/*
+Opens a pidfd for a process of a new background job and adds it to the
+epoll set, so its termination wakes up the event loop. If pidfd_open() is
+not available, the process is picked up when SIGCHLD arrives instead.
+
+Receives: -struct job* job: The new background job.
+          -int proc: Index of the process in job->procs.
+Returns: Nothing
+*/
+	struct epoll_event event = {0};
+	int pidfd;
+
+	pidfd = syscall(SYS_pidfd_open, job->procs[proc].pid, 0);
+	job->procs[proc].pidfd = pidfd;
+	if (pidfd == -1)
+	{
+		unwatched_bg++;
+		return;
+	}
+
+	// The event carries the job id and the index of the process.
+	event.events = EPOLLIN;
+	event.data.u64 = ((uint64_t) job->id << 32) | proc;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, pidfd, &event);
+}
+
+void unwatch_bg(struct job* job, int proc){
+/*
+Stops watching a process that has been cleaned up or is about to be
+removed from the job table, closing its pidfd (which also removes it from
+the epoll set).
+
+Receives: -struct job* job: The job.
+          -int proc: Index of the process in job->procs.
+Returns: Nothing
+*/
+	if (job->procs[proc].pidfd != -1)
+		close(job->procs[proc].pidfd);
+	else
+		unwatched_bg--;
+	job->procs[proc].pidfd = -1;
+}
+
+static int reap_unwatched(struct job_table* jobs){
+/*
+Checks the background processes that have no pidfd. Only called after a
+SIGCHLD when such processes exist. Each one is waited for by its pid, so
+the zygote and foreground processes are left to their own waits.
+
+Receives: struct job_table* jobs: The job table.
+Returns: int: Number of jobs that were reported.
+*/
+	struct job* job;
+	int reaped = 0;
+	int proc;
+	int i;
+
+	for (i = 0; i < jobs->capacity && unwatched_bg > 0; i++)
+	{
+		job = &jobs->jobs[i];
+
+		// A job that is reported is removed, so stop at a free slot.
+		for (proc = 0; proc < job->num_procs && job->state != JOB_FREE; proc++)
+		{
+			if (job->procs[proc].pid != 0 && job->procs[proc].pidfd == -1)
+				reaped += reap_bg(jobs, job, proc);
+		}
+	}
+
+	return reaped;
+}
+
+int wait_events(int timeout, struct job_table* jobs){
+/*
+Waits until stdin is readable or a background process terminates. Every
+terminated background process is cleaned up and reported before returning.
+
+Receives: -int timeout: Milliseconds to wait, -1 to wait forever, 0 to
+           only handle events that are already pending.
+          -struct job_table* jobs: The job table.
+
+Returns: int: EVENT_INPUT and/or EVENT_REAPED bits, 0 on timeout, or -1 if
+              the wait was interrupted by a signal (e.g. SIGTSTP).
+*/
+	struct epoll_event events[64];
+	struct signalfd_siginfo info;
+	struct job* job;
+	int proc;
+	int num_events;
+	int result = 0;
+	int i;
+
+	if (stdin_always_ready && !input_paused)
+		timeout = 0;
+
+	num_events = epoll_wait(epoll_fd, events, 64, timeout);
+	if (num_events == -1)
+		return (errno == EINTR) ? -1 : 0;
+
+	// A full batch means more events may be ready. Handle this batch, then
+	// collect the rest without waiting.
+	for (i = 0; i < num_events; i++)
+	{
+		if (events[i].data.u64 == STDIN_EVENT)
+			result |= EVENT_INPUT;
+
+		// Drain the signalfd. Processes with a pidfd get their own event,
+		// so only the ones without one need to be checked here.
+		else if (events[i].data.u64 == SIGCHLD_EVENT)
+		{
+			while (read(sigchld_fd, &info, sizeof(info)) == sizeof(info))
+				continue;
+			if (unwatched_bg > 0 && reap_unwatched(jobs) > 0)
+				result |= EVENT_REAPED;
+		}
+
+		// A pidfd became readable, so that process has terminated. It is
+		// cleaned up by reap_bg(), which also closes the pidfd and with it
+		// the epoll registration, and reports the job once it is done.
+		else
+		{
+			job = find_job_id(jobs, events[i].data.u64 >> 32);
+			proc = events[i].data.u64 & 0xffffffff;
+			if (job != NULL && proc < job->num_procs && job->procs[proc].pid != 0
+				&& reap_bg(jobs, job, proc))
+				result |= EVENT_REAPED;
+		}
+
+		if (i == num_events - 1 && num_events == 64)
+		{
+			num_events = epoll_wait(epoll_fd, events, 64, 0);
+			i = -1;
+		}
+	}
+
+	if (stdin_always_ready && !input_paused)
+		result |= EVENT_INPUT;
+
+	return result;
+}
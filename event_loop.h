@@ -0,0 +1,16 @@
+#ifndef __EVENT_LOOP_H__
+#define __EVENT_LOOP_H__
+
+#include "job_table.h"
+
+// Bits returned by wait_events().
+#define EVENT_INPUT 1  // stdin is readable
+#define EVENT_REAPED 2 // at least one background job was reported
+
+int init_events(int watch_stdin);
+void watch_input(int watch);
+void watch_bg(struct job* job, int proc);
+void unwatch_bg(struct job* job, int proc);
+int wait_events(int timeout, struct job_table* jobs);
+
+#endif // __EVENT_LOOP_H__
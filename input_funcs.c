@@ -1,62 +1,249 @@
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/types.h> 
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <errno.h>
 #include "command_info.h"
 #include "input_funcs.h"
+#include "scan.h"
+#include "arena.h"
+#include "placement.h"
+#include "proc_subst.h"
+
+// Buffered reader for the shell's input. Input is read from in_fd (stdin
+// unless a script was given) with read() instead of stdio so that the event
+// loop in main can tell whether a complete line is already buffered before
+// it waits on stdin. in_buf holds in_len bytes, of which everything before
+// in_pos has already been returned. A script that is a regular file is
+// memory-mapped instead, in which case in_buf is the mapping and in_eof is
+// set from the start.
+static int in_fd = STDIN_FILENO;
+static char* in_buf = NULL;
+static size_t in_cap = 0;
+static size_t in_len = 0;
+static size_t in_pos = 0;
+static bool in_eof = false;
+
+// Set if the commands come from a script or -c string rather than stdin.
+static bool in_script = false;
+
+// Size of the buffer used to stream a script that can't be memory-mapped.
+#define SCRIPT_BLOCK_SIZE (1 << 20)
+
+int input_from_file(const char* path){
+/*
+Makes the shell read its commands from a script file instead of stdin.
+Regular files are memory-mapped, so lines are scanned in place without any
+read() calls. Anything else (a pipe, a device) is streamed in large blocks.
+
+Receives: const char* path: Path of the script.
+Returns: int: 0 if successful, -1 if the file could not be opened.
+*/
+	struct stat info;
+	void* mapping;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+		return -1;
 
-char* arg_str(void){
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+	{
+		mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED)
+		{
+			madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+			close(fd);
+			in_buf = mapping;
+			in_len = info.st_size;
+			in_cap = info.st_size;
+			in_eof = true;
+			in_script = true;
+			return 0;
+		}
+	}
+
+	in_fd = fd;
+	in_script = true;
+	in_cap = SCRIPT_BLOCK_SIZE;
+	in_buf = malloc(in_cap);
+	return 0;
+}
+
+void input_from_string(const char* string){
+/*
+Makes the shell read its commands from a string (smallsh -c) instead of
+stdin. The string may hold several lines.
+
+Receives: const char* string: The commands.
+Returns: Nothing
+*/
+	in_buf = strdup(string);
+	in_len = strlen(string);
+	in_cap = in_len;
+	in_eof = true;
+	in_script = true;
+}
+
+bool input_pending(void){
+/*
+Checks if a complete line (or the final unterminated line at end of
+file) is already buffered, so arg_str() can return it without reading.
+
+Receives: Nothing
+Returns: bool: true if arg_str() will not block, false otherwise.
+*/
+	return in_eof || memchr(in_buf + in_pos, '\n', in_len - in_pos) != NULL;
+}
+
+bool input_eof(void){
+/*
+Checks if stdin has reached end of file and all buffered input has been
+consumed.
+
+Receives: Nothing
+Returns: bool: true if there is no more input, false otherwise.
+*/
+	return in_eof && in_pos == in_len;
+}
+
+static ssize_t next_line(char** line){
+/*
+Finds the next line in the stdin buffer, reading more input from fd 0 as
+needed. The line is left in the buffer, including its newline.
+
+Receives: char** line: Set to the start of the line in the buffer.
+Returns: ssize_t: Length of the line including the newline. The last line
+                  of the input may not have a newline. Returns -1 at end
+                  of file or if read() was interrupted by a signal.
+*/
+	char* newline;
+	ssize_t num_read;
+	size_t line_len;
+
+	while ((newline = memchr(in_buf + in_pos, '\n', in_len - in_pos)) == NULL)
+	{
+		// At end of file, return whatever is left as the last line.
+		if (in_eof)
+		{
+			if (in_pos == in_len)
+				return -1;
+			*line = in_buf + in_pos;
+			line_len = in_len - in_pos;
+			in_pos = in_len;
+			return line_len;
+		}
+
+		// Move the unconsumed bytes to the front of the buffer, and grow
+		// the buffer if there is no room for more input.
+		memmove(in_buf, in_buf + in_pos, in_len - in_pos);
+		in_len -= in_pos;
+		in_pos = 0;
+		if (in_cap - in_len < 1024)
+		{
+			in_cap = in_cap ? in_cap * 2 : 4096;
+			in_buf = realloc(in_buf, in_cap);
+		}
+
+		num_read = read(in_fd, in_buf + in_len, in_cap - in_len);
+		if (num_read == 0)
+			in_eof = true;
+		else if (num_read == -1)
+			return -1;
+		else
+			in_len += num_read;
+	}
+
+	*line = in_buf + in_pos;
+	line_len = newline - *line + 1;
+	in_pos += line_len;
+	return line_len;
+}
+
+ssize_t data_line(char** line){
+/*
+Reads a line of data from stdin for a builtin (parallel). If the shell's
+commands also come from stdin, the line is taken from the same buffer, so
+no input that was already read is lost. On a terminal, end of file only
+ends the data, and the shell keeps reading commands afterwards.
+
+Receives: char** line: Set to the line, including its newline. It is only
+                       valid until the next call.
+Returns: ssize_t: Length of the line, or -1 at end of file.
+*/
+	static char* data_buf = NULL;
+	static size_t data_cap = 0;
+	ssize_t line_len;
+
+	if (in_script)
+	{
+		line_len = getline(&data_buf, &data_cap, stdin);
+		*line = data_buf;
+		return line_len;
+	}
+
+	// next_line() also returns -1 if read() was interrupted by a signal.
+	while ((line_len = next_line(line)) == -1 && !in_eof && errno == EINTR)
+		continue;
+
+	if (line_len == -1 && in_eof && isatty(STDIN_FILENO))
+		in_eof = false;
+
+	return line_len;
+}
+
+char* arg_str(struct arena* arena){
 /*
 Gets a line of a user's input. If the line is just a newline char,
 starts with '#' or is all spaces, return NULL. Otherwise, strip
 the newline from the line.
 
-Receivs: Nothing
-Returns: -Char pointer to allocated string.
+Receivs: struct arena* arena: Arena of the current command, which will
+                              hold the line.
+Returns: -Char pointer to the string in the arena.
          -NULL if all spaces, started with #, or just newline.
+         -NULL at end of file, in which case input_eof() returns true.
 */
-	char* line = NULL; // Will store getline() input
-	size_t num = 0;    // Simply used as an arg for getline()
-	ssize_t line_len;  // Will hold return val from getline()
+	char* buffered;    // Will point to the line in the input buffer
+	char* line;        // Will store a copy of the line
+	ssize_t line_len;  // Will hold return val from next_line()
 
-	// Get the user's command input from the terminal stored in line. The
-	// line_len variable records the number of chars the user entered.
-	line_len = getline(&line, &num, stdin);
+	// Get the user's command input from the terminal. The line_len variable
+	// records the number of chars the user entered.
+	line_len = next_line(&buffered);
 
-	// Handle error if there is a signal interrupts getline(), then just
-	// return NULL, which will take the user back to a new prompt.
+	// Handle error if there is a signal interrupts read(), or if there is
+	// no more input. Return NULL, which will take the user back to a new
+	// prompt (or exit, at end of file).
 	if (line_len == -1)
-	{
-		clearerr(stdin);
 		return NULL;	
-	}
 
 	// Special case: If the user entered the enter key without any
 	// other characters, the length of the string will just be 1, as it
 	// only contains the newline char. In this case return null, which will 
 	// re-prompt the user for input in the main function.
-	if (line_len == 1){
-		free(line);
+	if (line_len == 1 && *buffered == '\n')
 		return NULL;
-	}
 
-	// Max char len is 2048. If user entered too many chars, exit with error.
-	if (line_len > 2049){
-		free(line);
-		exit(1);
-	}
+	// Copy the line out of the input buffer into the command's arena,
+	// terminating it the same way getline() would.
+	line = arena_strndup(arena, buffered, line_len);
 
-	// Remove the newline char at the end of the string.
-	strip_newline(line, line_len);
+	// Remove the newline char at the end of the string. The last line of
+	// the input may not have one.
+	if (line[line_len - 1] == '\n')
+		strip_newline(line, line_len);
 
 	// If the user's input was a comment or just all spaces, return null
 	// which will re-prompt the user for input in the main function.
-	if (comment_or_space(line)){
-		free(line);
+	if (comment_or_space(line))
 		return NULL;
-	}
 
 	// If this point is reached, the user's input was not empty, just spaces, or
 	// a comment, so we return a pointer to the string.
@@ -84,11 +271,11 @@ Receives: -char* string: string we will remove newline from.
 
 bool comment_or_space(char* string){
 /*
-Determines if a string is a comment (starts with '#') or all spaces.
-Assumes string is not of length 0.
+Determines if a string is a comment (starts with '#') or all blanks
+(spaces and tabs). Assumes string is not of length 0.
 
 Receives: char* string: String we will be analyzing
-Returns: bool: true if a comment or all spaces, false otherwise
+Returns: bool: true if a comment or all blanks, false otherwise
 */
 
 	// Check if first character of the string is a comment char.
@@ -96,220 +283,624 @@ Returns: bool: true if a comment or all spaces, false otherwise
 		return true;
 	
 	// Iterate through each char of the string. As long as each char
-	// is a space, keep going. When we exit the loop, there are two possibilities:
-	// 1) Every char was a space and str will point to the null-byte
-	// 2) Not every char was a space and str will not point to the null-byte
-	while (*string == ' ')
+	// is a blank, keep going. When we exit the loop, there are two possibilities:
+	// 1) Every char was a blank and str will point to the null-byte
+	// 2) Not every char was a blank and str will not point to the null-byte
+	while (*string == ' ' || *string == '\t')
 		string++;
 
-	// If we're at the null-byte, it's all spaces, otherwise it's not.
+	// If we're at the null-byte, it's all blanks, otherwise it's not.
 	if (*string == '\0')
 		return true;
 	else
 		return false;
 }
 
-char* expand_pid(char* token){
+// States of the lexer in tokenize().
+enum lex_state {
+	LEX_BLANK,  // between words
+	LEX_WORD,   // inside an unquoted part of a word
+	LEX_SINGLE, // inside '...'
+	LEX_DOUBLE  // inside "..."
+};
+
+// What the next word of the line will be used for.
+enum word_role {
+	WORD_ARG,    // an argument of the current command
+	WORD_STDIN,  // the file after <
+	WORD_STDOUT, // the file after >
+	WORD_HEREDOC,// the end word after <<
+	WORD_HERESTR // the string after <<<
+};
+
+// Number of args a command has room for at first. The array is doubled in
+// the arena whenever it fills up, so there is no limit.
+#define INITIAL_ARGS 16
+
+static const char* pid_string(int* length){
 /*
-Allocates memory for the token and expands the "$$" sub-string to the
-process id if encountered.
+Returns the shell's pid as a string, used to expand "$$". The string is
+built on the first call only.
 
-Receives: char* token: The input string that will be expanded. Does
-                       not contain any spaces.
-Returns: char*: Pointer to dynamically allocated, expanded string.
+Receives: int* length: Set to the number of chars in the string.
+Returns: const char*: The pid string.
 */
-	char* dollar_ptr;
-	char* expanded_str;
-	char* expanded_str_cpy;
-	char* pid_str;
-	char* token_cpy;
-	int procID;
-	int num_dollars;
-	int num_chars;
-	int temp;
-	int expanded_size;
-
-	// Find how many instances of $$ exist in the token.
-	// At the start there are no $$ instances, so set num_dollars to 0.
-	// Make a copy of the token ptr that we'll use to iterate through
-	// the string.
-	num_dollars = 0;
-	token_cpy = token;
-
-	// Use strstr to find "$$" sub-string. If found, returns ptr to
-	// that sub-string.
-	while ((dollar_ptr = strstr(token_cpy, "$$")) != NULL)
-	{
-		// Found sub_string. Increment num_dollars, and increment
-		// token_cpy by two so we now have a ptr to the char immediately
-		// after the second '$' char. If we reached the end of the
-		// string, break out.
-		num_dollars++;
-		token_cpy = dollar_ptr + 2;
-		if (*token_cpy == '\0')
-			break;
-	}
+	static char pid_str[16];
+	static int pid_len = 0;
 
-	// If there were no double dollar signs, no expansion needed. Return
-	// a malloc'd version of the original token.
-	if (num_dollars == 0)
-	{
-		expanded_str = malloc((strlen(token)+1) * sizeof(char));
-		strcpy(expanded_str, token);
-		return expanded_str;
-	}
-	
-	// Get the proc ID, then calculate the # of chars of storage needed 
-	// for the pid by successively dividing by ten and taking the floor.
-	procID = (int) getpid();
-	temp = procID;
-	num_chars = 0;
-	while (temp > 0)
+	if (pid_len == 0)
+		pid_len = sprintf(pid_str, "%d", (int) getpid());
+
+	*length = pid_len;
+	return pid_str;
+}
+
+static void init_stage(struct command_info* stage, struct arena* arena){
+/*
+Resets the fields of a pipeline stage before tokenize() fills it, with an
+empty args array of INITIAL_ARGS entries.
+
+Receives: -struct command_info* stage: The stage to reset.
+          -struct arena* arena: Arena of the command.
+Returns: Nothing
+*/
+	stage->args = arena_alloc(arena, INITIAL_ARGS * sizeof(char*));
+	stage->max_args = INITIAL_ARGS;
+	stage->args[0] = NULL;
+	stage->stdin_file = NULL;
+	stage->stdin_data = NULL;
+	stage->heredoc_end = NULL;
+	stage->stdout_file = NULL;
+	stage->subst = NULL;
+	stage->background = 0;
+	stage->placement = NULL;
+	stage->next_stage = NULL;
+	stage->next_op = LIST_END;
+	stage->next_command = NULL;
+}
+
+static void add_arg(struct command_info* stage, int* num_args, char* word, struct arena* arena){
+/*
+Appends an arg to a stage for tokenize(), doubling the args array when it
+is full. There is always room left for the NULL at the end.
+
+Receives: -struct command_info* stage: The stage.
+          -int* num_args: Number of args so far, incremented.
+          -char* word: The arg.
+          -struct arena* arena: Arena of the command.
+Returns: Nothing
+*/
+	char** args;
+
+	if (*num_args + 2 > stage->max_args)
 	{
-		temp /= 10;	
-		num_chars++;
+		args = arena_alloc(arena, stage->max_args * 2 * sizeof(char*));
+		memcpy(args, stage->args, *num_args * sizeof(char*));
+		stage->args = args;
+		stage->max_args *= 2;
 	}
+	stage->args[(*num_args)++] = word;
+}
 
-	// Allocate space to hold string version of procID with malloc. Then,
-	// store procID as a string in the malloc'd memory.
-	pid_str = malloc((num_chars+1) * sizeof(char));
-	sprintf(pid_str, "%d", procID);
-	
+static struct proc_subst* new_subst(struct command_info* stage, const char* command, size_t length,
+	int output, struct arena* arena){
+/*
+Adds a process substitution found by tokenize() to a pipeline stage. It
+does not run until start_substs() is called.
+
+Receives: -struct command_info* stage: The stage whose word it is.
+          -const char* command: Start of the inner command line.
+          -size_t length: Length of the inner command line.
+          -int output: 0 for <(command), 1 for >(command).
+          -struct arena* arena: Arena of the command.
+Returns: struct proc_subst*: The substitution. Its path is the word.
+*/
+	struct proc_subst* subst = arena_alloc(arena, sizeof(struct proc_subst));
+
+	subst->command = arena_strndup(arena, command, length);
+	subst->output = output;
+	subst->path = arena_alloc(arena, SUBST_PATH_SIZE);
+	strcpy(subst->path, "/dev/fd/");
+	subst->fd = -1;
+	subst->next = stage->subst;
+	stage->subst = subst;
+	return subst;
+}
 
-	// Calculate the size of the new, expanded string. We subtract the 
-	// $$ chars (2*num_dollars), then add the chars needed for the pid with
-	// (num_chars*num_dollars). Then, allocate memory for the expanded string.
-	expanded_size = strlen(token) - (2 * num_dollars) + (num_chars * num_dollars) + 1;
-	expanded_str = malloc(expanded_size * sizeof(char));
-	expanded_str_cpy = expanded_str;
-	
-	// If the size of the expanded string is more than the max of 2048 chars, 
-	// return failure.
-	if (expanded_size > 2049)
-		exit(1);
+static char* parse_subst(char** pos, struct command_info* stage, struct arena* arena){
+/*
+Parses a process substitution, <(command) or >(command), for tokenize().
+The command ends at the matching ")", skipping over quotes, and is run
+later by start_substs().
+
+Receives: -char** pos: Points to the "<" or ">". Moved to the ")".
+          -struct command_info* stage: The stage the word belongs to.
+          -struct arena* arena: Arena of the command.
+Returns: char*: The word that will be replaced by /dev/fd/N, or NULL if
+                there is no matching ")".
+*/
+	char* start = *pos + 2;
+	char* p;
+	int output = (**pos == '>');
+	int depth = 1;
 
-	// This is where we actually copy the expanded string into memory
-	while (*token)
+	for (p = start; *p != '\0'; p++)
 	{
-		// If we encounter $$ in the original string, copy the PID string into 
-		// the expanded string, then increment token by 2 to pass the second $
-		// char, and increment the expanded string ptr by the number of chars
-		// in the PID string.
-		if (*token == '$' && *(token+1) == '$')
+		if (*p == '\\' && p[1] != '\0')
+			p++;
+		else if (*p == '\'')
 		{
-			memcpy(expanded_str_cpy, pid_str, num_chars);
-			token += 2;
-			expanded_str_cpy += num_chars;
+			while (p[1] != '\0' && p[1] != '\'')
+				p++;
+			p++;
 		}
-
-		// If we don't encounter $$, simply add the token character to the
-		// corresponding character in the expanded string and increment both
-		// pointers.
-		else
+		else if (*p == '"')
 		{
-			*expanded_str_cpy = *token;
-			expanded_str_cpy++;
-			token++;
+			while (p[1] != '\0' && p[1] != '"')
+				p += (p[1] == '\\' && p[2] != '\0') ? 2 : 1;
+			p++;
 		}
+		else if (*p == '(')
+			depth++;
+		else if (*p == ')' && --depth == 0)
+			break;
+
+		if (*p == '\0')
+			break;
 	}
 
-	// Add null-byte to the end of the expanded string.
-	*expanded_str_cpy = '\0';
+	if (*p != ')')
+		return NULL;
+
+	*pos = p;
+	return new_subst(stage, start, p - start, output, arena)->path;
+}
 
-	// Free memory for the pid string.
-	free(pid_str);
+static int has_redirection(const struct command_info* stage){
+/*
+Checks whether a stage of tokenize() has any redirection.
 
-	// Return pointer to the start of the malloc'd expansion string.
-	return expanded_str;	
+Receives: const struct command_info* stage: The stage to check.
+Returns: int: 1 if it has one, 0 otherwise.
+*/
+	return stage->stdin_file != NULL || stage->stdout_file != NULL
+		|| stage->stdin_data != NULL || stage->heredoc_end != NULL;
 }
 
-void tokenize(char* inp_str, struct command_info* command_struct){
+static int syntax_error(const char* near){
 /*
-Takes a string of command input as input and parses it into a 
-struct containing arguments, input and output redirection files,
-and a background flag. Uses teh expand_pid() function to change
-the "$$" sub-string into a string representation of the pid.
+Prints a syntax error message for tokenize().
 
-Receives: -char* inp_str: The string to be parsed.
-          -struct command_info* command_struct: Pointer to struct
-		   that will hold parsed data.
+Receives: const char* near: The token the error was found at.
+Returns: int: Always -1, so tokenize() can return it directly.
+*/
+	printf("syntax error near unexpected token '%s'\n", near);
+	fflush(stdout);
+	return -1;
+}
 
-Returns: Nothing. Data will be stored in the struct whose pointer
-         was passed as input.
+int tokenize(char* inp_str, struct command_info* command_struct, struct arena* arena){
+/*
+Parses a line of command input into a command list in a single pass. The
+line is first scanned for the chars that matter to the lexer (see scan.h),
+and the chars between them are copied a run at a time.
+
+Words are separated by blanks, and "|", "<", ">", "&" and ";" end a word.
+Quotes and backslashes work as in sh, and "$$" becomes the pid of the
+shell outside single quotes. "<", ">", "<<<" and "<<" set the stdin_file,
+stdout_file, stdin_data or heredoc_end of the stage. "|" links the next
+stage through next_stage, and ";", "&&" and "||" link the next pipeline
+through next_command. "&" at the end of a pipeline sets its background
+flag. A trailing ";" is ignored, but a command with only redirections is a
+syntax error. Everything is allocated from the arena.
+
+Receives: -char* inp_str: The string to be parsed, held in the arena.
+          -struct command_info* command_struct: Filled with the parsed
+           command list.
+          -struct arena* arena: Arena of the current command.
+Returns: int: 0 if successful, -1 if there is a syntax error, in which case
+              an error message has been printed.
 */
-	char* token;
-	char* saveptr;
-	int i, j;
-	command_struct->stdin_file = NULL;
-	command_struct->stdout_file = NULL;
-	command_struct->background = 0;
-
-	// Get the first argument. The expand_pid function returns a pointer
-	// to dynamically allocated memory.
-	token = strtok_r(inp_str, " ", &saveptr);
-	command_struct->args[0] = expand_pid(token);
-
-	// Loop through each argument. If an argument is preceded by "<" or by
-	// ">", add it to the struct member stdin_file or stdout_file. i keeps
-	// track of how many args were given.
-	i = 1;
-	while ((token = strtok_r(NULL, " ", &saveptr)) != NULL)
+	struct command_info* stage = command_struct;
+	struct command_info* pipeline = command_struct;
+	struct command_info* prev_pipeline = NULL;
+	enum lex_state state = LEX_BLANK;
+	enum list_op op;
+	enum word_role role = WORD_ARG;
+	const char* pid_str;
+	int pid_len;
+	int amp_pending = 0;
+	int i = 0;
+	char* word = NULL;
+	char* out;
+	size_t word_len;
+	size_t length = strlen(inp_str);
+	size_t run;
+	uint64_t* bits;
+	char* p;
+	char c;
+
+	init_stage(stage, arena);
+
+	// Words are written to a buffer in the arena as they are lexed. Each
+	// "$$" (2 chars) can grow to the length of the pid, so this is the most
+	// the line can expand to.
+	pid_str = pid_string(&pid_len);
+	out = arena_alloc(arena, length * (pid_len / 2 + 1) + 2);
+
+	// Mark the chars the lexer has to look at, see scan.h.
+	bits = arena_alloc(arena, SCAN_WORDS(length) * sizeof(uint64_t));
+	scan_line(inp_str, length, bits);
+
+	for (p = inp_str; ; p++)
 	{
-		// Expand token to substitute PID for $$.
-		command_struct->args[i] = expand_pid(token);
+		// Copy the run of ordinary chars up to the next marked one. They
+		// are part of a word in every state, and start one between words.
+		run = scan_next(bits, p - inp_str) - (p - inp_str);
+		if (run > 0)
+		{
+			if (state == LEX_BLANK)
+			{
+				word = out;
+				state = LEX_WORD;
+			}
+			memcpy(out, p, run);
+			out += run;
+			p += run;
+		}
 
-		// If the previous token was "<" fill the stdin_file with the
-		// current token
-		if (strcmp(command_struct->args[i-1], "<") == 0)
-			command_struct->stdin_file = command_struct->args[i];
+		c = *p;
 
-		// If the previous token was ">" fill the stdout_file with the
-		// current token
-		else if (strcmp(command_struct->args[i-1], ">") == 0)
-			command_struct->stdout_file = command_struct->args[i];
+		// Inside single quotes everything is literal.
+		if (state == LEX_SINGLE)
+		{
+			if (c == '\0')
+				return syntax_error("'");
+			if (c == '\'')
+				state = LEX_WORD;
+			else
+				*out++ = c;
+			continue;
+		}
 
-		// Increment i to point to the next member of the args array
-		i++;
-	}
+		// Inside double quotes only "$$" and a few escapes are special.
+		if (state == LEX_DOUBLE)
+		{
+			if (c == '\0')
+				return syntax_error("\"");
+			if (c == '"')
+				state = LEX_WORD;
+			else if (c == '\\' && (p[1] == '"' || p[1] == '\\' || p[1] == '$'))
+				*out++ = *++p;
+			else if (c == '$' && p[1] == '$')
+			{
+				memcpy(out, pid_str, pid_len);
+				out += pid_len;
+				p++;
+			}
+			else
+				*out++ = c;
+			continue;
+		}
 
-	// Fill the last arg with NULL. Will be useful when calling exec funcs.
-	command_struct->args[i] = NULL;
-
-	// If the last member of args is &, set the background flag.
-	if (strcmp(command_struct->args[i-1], "&") == 0)
-		command_struct->background = 1;
-
-	// At this point, we have our struct filled, but our args array is over-filled.
-	// We need to remove the trailing & character, if it exists, as well as <, >, 
-	// and their associated filenames. These must be removed because they should
-	// not be in the array that is passed to exec. We start by looping through
-	// the array. Note that i is the index of the NULL ptr marking the array's end.
-	for (j=0; j<i; j++)	
-	{
-		// If we find an &, treat it as a normal arg and don't delete it
-		// unless it's the last arg in the array.
-		if (strcmp(command_struct->args[j], "&") == 0)
+		// Unquoted. A blank, an operator or the end of the line ends the
+		// current word.
+		if (c == ' ' || c == '\t' || c == '\0' || c == '|' || c == '<' || c == '>' || c == '&' || c == ';')
 		{
-			if (command_struct->args[j+1] == NULL)
+			if (state == LEX_WORD)
+			{
+				*out++ = '\0';
+				state = LEX_BLANK;
+
+				// An "&" followed by more input is a normal arg.
+				if (amp_pending && role == WORD_ARG)
+				{
+					add_arg(stage, &i, "&", arena);
+					amp_pending = 0;
+				}
+
+				if (role == WORD_STDIN)
+				{
+					stage->stdin_file = word;
+					stage->stdin_data = NULL;
+					stage->heredoc_end = NULL;
+				}
+				else if (role == WORD_HEREDOC)
+				{
+					stage->heredoc_end = word;
+					stage->stdin_file = NULL;
+					stage->stdin_data = NULL;
+				}
+				else if (role == WORD_HERESTR)
+				{
+					word_len = strlen(word);
+					stage->stdin_data = arena_alloc(arena, word_len + 2);
+					memcpy(stage->stdin_data, word, word_len);
+					stage->stdin_data[word_len] = '\n';
+					stage->stdin_data[word_len + 1] = '\0';
+					stage->stdin_file = NULL;
+					stage->heredoc_end = NULL;
+				}
+				else if (role == WORD_STDOUT)
+					stage->stdout_file = word;
+				else
+					add_arg(stage, &i, word, arena);
+				role = WORD_ARG;
+			}
+
+			if (c == ' ' || c == '\t')
+				continue;
+
+			if (c == '\0')
+				break;
+
+			// "<(" and ">(" start a process substitution, which is a word on
+			// its own: an arg, or the file of a redirection.
+			if ((c == '<' || c == '>') && p[1] == '(')
+			{
+				if ((word = parse_subst(&p, stage, arena)) == NULL)
+					return syntax_error("(");
+
+				if (amp_pending)
+				{
+					add_arg(stage, &i, "&", arena);
+					amp_pending = 0;
+				}
+
+				if (role == WORD_STDIN)
+				{
+					stage->stdin_file = word;
+					stage->stdin_data = NULL;
+					stage->heredoc_end = NULL;
+				}
+				else if (role == WORD_STDOUT)
+					stage->stdout_file = word;
+				else if (role != WORD_ARG)
+					return syntax_error("(");
+				else
+					add_arg(stage, &i, word, arena);
+				role = WORD_ARG;
+				continue;
+			}
+
+			// Operators. A redirection must be followed by its file name.
+			if (role != WORD_ARG)
+				return syntax_error((char[]) {c, '\0'});
+
+			// ";", "&&" and "||" end the current pipeline and start the next
+			// one of the list. Only ";" may follow a background "&".
+			if (c == ';' || (c == '&' && p[1] == '&') || (c == '|' && p[1] == '|'))
+			{
+				op = (c == ';') ? LIST_SEQ : (c == '&') ? LIST_AND : LIST_OR;
+				if (op == LIST_SEQ && amp_pending && i > 0)
+				{
+					pipeline->background = 1;
+					amp_pending = 0;
+				}
+				if (i == 0 || amp_pending)
+					return syntax_error((op == LIST_SEQ) ? ";" : (op == LIST_AND) ? "&&" : "||");
+				if (op != LIST_SEQ)
+					p++;
+
+				stage->args[i] = NULL;
+				pipeline->next_op = op;
+				pipeline->next_command = arena_alloc(arena, sizeof(struct command_info));
+				prev_pipeline = pipeline;
+				pipeline = pipeline->next_command;
+				stage = pipeline;
+				init_stage(stage, arena);
+				i = 0;
+				continue;
+			}
+
+			if (amp_pending)
 			{
-				free(command_struct->args[j]);
-				command_struct->args[j] = NULL;
+				add_arg(stage, &i, "&", arena);
+				amp_pending = 0;
 			}
+
+			if (c == '<' && p[1] == '<' && p[2] == '<')
+			{
+				role = WORD_HERESTR;
+				p += 2;
+			}
+			else if (c == '<' && p[1] == '<')
+			{
+				role = WORD_HEREDOC;
+				p++;
+			}
+			else if (c == '<')
+				role = WORD_STDIN;
+			else if (c == '>')
+				role = WORD_STDOUT;
+			else if (c == '&')
+				amp_pending = 1;
+
+			// A "|" ends the current stage and starts a new one.
+			else
+			{
+				if (i == 0)
+					return syntax_error("|");
+				stage->args[i] = NULL;
+				stage->next_stage = arena_alloc(arena, sizeof(struct command_info));
+				stage = stage->next_stage;
+				init_stage(stage, arena);
+				i = 0;
+			}
+			continue;
+		}
+
+		// Any other char starts or continues a word.
+		if (state == LEX_BLANK)
+		{
+			word = out;
+			state = LEX_WORD;
 		}
 
-		// If we find a < or >, according to the assignment rubric nothing
-		// after those symbols will be an arg, so we can delete every array
-		// element until the end of the array.
-		else if ((strcmp(command_struct->args[j], "<") == 0) ||
-			(strcmp(command_struct->args[j], ">") == 0))
+		if (c == '\'')
+			state = LEX_SINGLE;
+		else if (c == '"')
+			state = LEX_DOUBLE;
+		else if (c == '\\' && p[1] != '\0')
+			*out++ = *++p;
+		else if (c == '$' && p[1] == '$')
+		{
+			memcpy(out, pid_str, pid_len);
+			out += pid_len;
+			p++;
+		}
+		else
+			*out++ = c;
+	}
+
+	// A redirection at the end of the line has no file name.
+	if (role != WORD_ARG)
+		return syntax_error("newline");
+
+	// Fill the last arg with NULL. Will be useful when calling exec funcs.
+	stage->args[i] = NULL;
+
+	// A list that ends with ";" has nothing after it. A redirection after
+	// it is not dropped, it is reported below.
+	if (i == 0 && stage == pipeline && !amp_pending && !has_redirection(stage)
+		&& prev_pipeline != NULL && prev_pipeline->next_op == LIST_SEQ)
+	{
+		prev_pipeline->next_op = LIST_END;
+		prev_pipeline->next_command = NULL;
+		return 0;
+	}
+
+	// A line that ends with "|", "&&" or "||" leaves a stage without a
+	// command. The "|" is reported if it is all the stage has, and the end
+	// of the line otherwise, as for a line with only redirections.
+	if (i == 0)
+		return syntax_error(amp_pending ? "&"
+			: (stage == pipeline || has_redirection(stage)) ? "newline" : "|");
+
+	// If the last token of the line is &, set the background flag. The flag
+	// belongs to the whole pipeline, so it is set on its first stage.
+	if (amp_pending)
+		pipeline->background = 1;
+
+	return 0;
+}
+
+int read_heredocs(struct command_info* command_struct, struct arena* arena){
+/*
+Reads the bodies of the here-documents of a command line, in the order
+they appear, from the lines of input that follow it. Each body ends at a
+line that is exactly its heredoc_end word and becomes the stage's
+stdin_data. The body is kept as it is, without "$$" expansion. On a
+terminal, each line is prompted for with "> ".
+
+Receives: -struct command_info* command_struct: First command of the list.
+          -struct arena* arena: Arena of the command, which will hold the
+           bodies.
+Returns: int: 0 if successful, -1 if the input ended before a body was
+              complete, after printing an error.
+*/
+	struct command_info* pipeline;
+	struct command_info* stage;
+	char* body = NULL;
+	size_t body_cap = 0;
+	size_t body_len;
+	size_t end_len;
+	char* line;
+	ssize_t line_len;
+
+	for (pipeline = command_struct; pipeline != NULL; pipeline = pipeline->next_command)
+	{
+		for (stage = pipeline; stage != NULL; stage = stage->next_stage)
 		{
-			// This loop executes if we found < or >, setting all args after
-			// to NULL.
-			while (j<i)
+			if (stage->heredoc_end == NULL)
+				continue;
+
+			end_len = strlen(stage->heredoc_end);
+			body_len = 0;
+			while (1)
 			{
-				command_struct->args[j] = NULL;
-				j++;
+				if (!in_script)
+				{
+					printf("> ");
+					fflush(stdout);
+				}
+
+				// next_line() also returns -1 if read() was interrupted.
+				while ((line_len = next_line(&line)) == -1 && !in_eof && errno == EINTR)
+					continue;
+				if (line_len == -1)
+				{
+					// On a terminal, end of file only ends the here-document.
+					if (in_eof && isatty(STDIN_FILENO))
+						in_eof = false;
+					printf("here-document ended by end of input (wanted '%s')\n", stage->heredoc_end);
+					fflush(stdout);
+					free(body);
+					return -1;
+				}
+
+				// The end word may be the last line of the input, without a
+				// newline.
+				if ((size_t) line_len >= end_len && memcmp(line, stage->heredoc_end, end_len) == 0
+					&& ((size_t) line_len == end_len || ((size_t) line_len == end_len + 1 && line[end_len] == '\n')))
+					break;
+
+				if (body_len + line_len + 1 > body_cap)
+				{
+					body_cap = (body_len + line_len + 1) * 2;
+					body = realloc(body, body_cap);
+				}
+				memcpy(body + body_len, line, line_len);
+				body_len += line_len;
 			}
+
+			stage->stdin_data = arena_strndup(arena, body ? body : "", body_len);
 		}
 	}
+
+	free(body);
+	return 0;
+}
+
+void command_line(struct command_info* command_struct, char* buffer, size_t size){
+/*
+Rebuilds a printable command line from a parsed command, used as the
+description of a background job. A placement prefix is included, so jobs
+shows where each job runs.
+
+Receives: -struct command_info* command_struct: The parsed command.
+          -char* buffer: Where the command line is written.
+          -size_t size: Size of buffer. Longer command lines are truncated.
+Returns: Nothing
+*/
+	struct command_info* stage;
+	size_t len = 0;
+	int i;
+
+	buffer[0] = '\0';
+	if (command_struct->placement != NULL)
+		len = snprintf(buffer, size, "%s", command_struct->placement->text);
+
+	for (stage = command_struct; stage != NULL && len < size; stage = stage->next_stage)
+	{
+		if (stage != command_struct)
+			len += snprintf(buffer + len, size - len, " |");
+
+		for (i = 0; stage->args[i] != NULL && len < size; i++)
+			len += snprintf(buffer + len, size - len, "%s%s", (len > 0) ? " " : "", stage->args[i]);
+
+		if (stage->stdin_file != NULL && len < size)
+			len += snprintf(buffer + len, size - len, " < %s", stage->stdin_file);
+		else if (stage->heredoc_end != NULL && len < size)
+			len += snprintf(buffer + len, size - len, " <<%s", stage->heredoc_end);
+		else if (stage->stdin_data != NULL && len < size)
+			len += snprintf(buffer + len, size - len, " <<< %.*s",
+				(int) strlen(stage->stdin_data) - 1, stage->stdin_data);
+
+		if (stage->stdout_file != NULL && len < size)
+			len += snprintf(buffer + len, size - len, " > %s", stage->stdout_file);
+	}
+
+	if (command_struct->background && len < size)
+		snprintf(buffer + len, size - len, " &");
 }
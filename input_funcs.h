@@ -2,12 +2,19 @@
 #define __INPUT_FUNCS_H__
 
 #include "command_info.h"
+#include "arena.h"
 #include <stdbool.h>
 
-char* arg_str(void);
+char* arg_str(struct arena* arena);
+bool input_pending(void);
+bool input_eof(void);
+int input_from_file(const char* path);
+void input_from_string(const char* string);
+ssize_t data_line(char** line);
 void strip_newline(char* string, ssize_t length);
 bool comment_or_space(char* string);
-char* expand_pid(char* token);
-void tokenize(char* inp_str, struct command_info* command_struct);
+int tokenize(char* inp_str, struct command_info* command_struct, struct arena* arena);
+int read_heredocs(struct command_info* command_struct, struct arena* arena);
+void command_line(struct command_info* command_struct, char* buffer, size_t size);
 
 #endif // __INPUT_FUNCS_H__
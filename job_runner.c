@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <errno.h>
+#include "job_runner.h"
+#include "command_info.h"
+#include "job_table.h"
+#include "event_loop.h"
+#include "spawn_engine.h"
+#include "input_funcs.h"
+
+int job_count(const char* text){
+/*
+Parses the N of parallel -j or batch -P.
+
+Receives: const char* text: The number.
+Returns: int: N, or 0 if it is not a number from 1 to MAX_JOBS.
+*/
+	char* end;
+	long value;
+
+	errno = 0;
+	value = strtol(text, &end, 10);
+	if (end == text || *end != '\0' || errno == ERANGE || value < 1 || value > MAX_JOBS)
+		return 0;
+	return value;
+}
+
+struct job* start_quiet_job(struct job_table* jobs, struct command_info* command, int null_stdin){
+/*
+Starts a command as a quiet job: it runs like a foreground command, so
+Ctrl-C reaches it, and is added to the job table so the event loop cleans
+it up without reporting it.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct command_info* command: The command.
+          -int null_stdin: 1 if the job reads /dev/null instead of the
+           terminal. It is not part of the job's command line.
+Returns: struct job*: The new job, or NULL if it could not be started.
+*/
+	struct job* job = NULL;
+	char job_line[256];
+	pid_t pid;
+
+	command_line(command, job_line, sizeof(job_line));
+	if (null_stdin)
+		command->stdin_file = "/dev/null";
+	spawn_pipeline(command, 0, &pid);
+
+	if (pid > 0)
+	{
+		job = add_job(jobs, &pid, 1, job_line);
+		job->quiet = QUIET_KEEP;
+		watch_bg(job, 0);
+	}
+
+	return job;
+}
+
+int run_quiet_jobs(struct job_table* jobs, const char* stdout_file, int max_jobs,
+	next_job_fn next, report_job_fn report, void* data){
+/*
+Runs the jobs of parallel and batch. Up to max_jobs are kept running, and
+the next one is started as soon as one finishes. A job killed by Ctrl-C
+stops the rest. All jobs share the stdout_file, and the shell's stdout is
+kept for the reports.
+
+Receives: -struct job_table* jobs: The job table.
+          -const char* stdout_file: Output file of all jobs, or NULL.
+          -int max_jobs: Most jobs running at once.
+          -next_job_fn next: Starts the next job.
+          -report_job_fn report: Reports each finished job, or NULL.
+          -void* data: Passed to next.
+Returns: int: Number of jobs that failed or could not be started, or -1 if
+              none could be run, in which case an error message has been
+              printed.
+*/
+	int* running;
+	struct job* job;
+	int num_running = 0;
+	int failed = 0;
+	int more = 1;
+	int report_fd = STDOUT_FILENO;
+	int saved_stdout = -1;
+	int out_fd;
+	int i;
+
+	// Job ids of the running jobs.
+	if ((running = malloc(max_jobs * sizeof(int))) == NULL)
+	{
+		perror("malloc");
+		fflush(stdout);
+		return -1;
+	}
+
+	if (stdout_file != NULL)
+	{
+		out_fd = open(stdout_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+		if (out_fd == -1)
+		{
+			perror(stdout_file);
+			fflush(stdout);
+			free(running);
+			return -1;
+		}
+		fflush(stdout);
+		saved_stdout = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+		dup2(out_fd, STDOUT_FILENO);
+		close(out_fd);
+		report_fd = saved_stdout;
+	}
+
+	// Only job terminations should wake up the event loop, so stdin is not
+	// watched meanwhile.
+	watch_input(0);
+
+	while (more || num_running > 0)
+	{
+		// Fill every free slot.
+		while (more && num_running < max_jobs)
+		{
+			if ((more = next(jobs, data, &job)) == 0)
+				break;
+
+			if (job != NULL)
+				running[num_running++] = job->id;
+			else
+				failed++;
+		}
+
+		if (num_running == 0)
+			break;
+
+		// Wait until at least one job is done. The event loop cleans it up
+		// and marks it as done.
+		wait_events(-1, jobs);
+
+		for (i = 0; i < num_running; )
+		{
+			job = find_job_id(jobs, running[i]);
+			if (job->state != JOB_DONE)
+			{
+				i++;
+				continue;
+			}
+
+			if (report != NULL)
+				report(report_fd, job);
+			if (!WIFEXITED(job->wstatus) || WEXITSTATUS(job->wstatus) != 0)
+				failed++;
+
+			// A job killed by Ctrl-C stops the rest.
+			if (WIFSIGNALED(job->wstatus) && WTERMSIG(job->wstatus) == SIGINT)
+				more = 0;
+
+			remove_job(jobs, job);
+			running[i] = running[--num_running];
+		}
+	}
+
+	watch_input(1);
+	free(running);
+
+	if (saved_stdout != -1)
+	{
+		fflush(stdout);
+		dup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdout);
+	}
+
+	return failed;
+}
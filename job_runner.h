@@ -0,0 +1,23 @@
+#ifndef __JOB_RUNNER_H__
+#define __JOB_RUNNER_H__
+
+#include "job_table.h"
+#include "command_info.h"
+
+// Most jobs parallel -j and batch -P can run at once.
+#define MAX_JOBS 1024
+
+// Starts the next job for run_quiet_jobs(). Returns 0 when there is nothing
+// left to start, 1 otherwise, with *job set to the new job, or NULL if it
+// could not be started.
+typedef int (*next_job_fn)(struct job_table* jobs, void* data, struct job** job);
+
+// Reports a finished job of run_quiet_jobs() on the shell's stdout.
+typedef void (*report_job_fn)(int report_fd, struct job* job);
+
+int job_count(const char* text);
+struct job* start_quiet_job(struct job_table* jobs, struct command_info* command, int null_stdin);
+int run_quiet_jobs(struct job_table* jobs, const char* stdout_file, int max_jobs,
+	next_job_fn next, report_job_fn report, void* data);
+
+#endif // __JOB_RUNNER_H__
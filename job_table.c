@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include "job_table.h"
+#include "jobstat.h"
+
+static unsigned int pid_slot(struct job_table* table, pid_t pid){
+/*
+Hashes a pid to its home position in the pid index.
+
+Receives: -struct job_table* table: The table.
+          -pid_t pid: The pid to hash.
+Returns: unsigned int: Position in table->pid_index.
+*/
+	return ((unsigned int) pid * 2654435761u) & (table->index_size - 1);
+}
+
+static void index_insert(struct job_table* table, pid_t pid, int slot){
+/*
+Adds a process to the pid index with linear probing.
+
+Receives: -struct job_table* table: The table.
+          -pid_t pid: pid of the process.
+          -int slot: Index of its job in table->jobs.
+Returns: Nothing
+*/
+	unsigned int pos = pid_slot(table, pid);
+
+	while (table->pid_index[pos].slot != 0)
+		pos = (pos + 1) & (table->index_size - 1);
+
+	table->pid_index[pos].pid = pid;
+	table->pid_index[pos].slot = slot + 1;
+	table->index_count++;
+}
+
+static void index_remove(struct job_table* table, pid_t pid){
+/*
+Removes a process from the pid index. Later entries of the same probe run
+are shifted back so that lookups never stop early at the hole.
+
+Receives: -struct job_table* table: The table.
+          -pid_t pid: pid of the process.
+Returns: Nothing
+*/
+	unsigned int mask = table->index_size - 1;
+	unsigned int pos = pid_slot(table, pid);
+	unsigned int next;
+	unsigned int home;
+
+	// Find the process's entry in the pid index.
+	while (table->pid_index[pos].slot != 0 && table->pid_index[pos].pid != pid)
+		pos = (pos + 1) & mask;
+	if (table->pid_index[pos].slot == 0)
+		return;
+
+	table->pid_index[pos].slot = 0;
+	table->pid_index[pos].pid = 0;
+	table->index_count--;
+
+	next = (pos + 1) & mask;
+	while (table->pid_index[next].slot != 0)
+	{
+		home = pid_slot(table, table->pid_index[next].pid);
+		if (((next - home) & mask) >= ((next - pos) & mask))
+		{
+			table->pid_index[pos] = table->pid_index[next];
+			table->pid_index[next].slot = 0;
+			table->pid_index[next].pid = 0;
+			pos = next;
+		}
+		next = (next + 1) & mask;
+	}
+}
+
+static void rebuild_index(struct job_table* table, int size){
+/*
+Rebuilds the pid index with a new size.
+
+Receives: -struct job_table* table: The table.
+          -int size: New size of the index, a power of two.
+Returns: Nothing
+*/
+	struct job* job;
+	int i, j;
+
+	free(table->pid_index);
+	table->index_size = size;
+	table->index_count = 0;
+	table->pid_index = calloc(size, sizeof(struct pid_entry));
+
+	for (i = 0; i < table->capacity; i++)
+	{
+		job = &table->jobs[i];
+		if (job->state == JOB_FREE)
+			continue;
+		for (j = 0; j < job->num_procs; j++)
+		{
+			if (job->procs[j].pid != 0)
+				index_insert(table, job->procs[j].pid, i);
+		}
+	}
+}
+
+static void grow(struct job_table* table){
+/*
+Doubles the number of job slots. The new slots are added to the free list
+in order, so the lowest new id is handed out first.
+
+Receives: struct job_table* table: The table to grow.
+Returns: Nothing
+*/
+	int old_capacity = table->capacity;
+	int i;
+
+	table->capacity = old_capacity ? old_capacity * 2 : 16;
+	table->jobs = realloc(table->jobs, table->capacity * sizeof(struct job));
+
+	for (i = old_capacity; i < table->capacity; i++)
+	{
+		table->jobs[i].id = i + 1;
+		table->jobs[i].state = JOB_FREE;
+		table->jobs[i].command = NULL;
+		table->jobs[i].procs = NULL;
+		table->jobs[i].next_free = (i + 1 < table->capacity) ? i + 1 : table->free_head;
+	}
+	table->free_head = old_capacity;
+}
+
+void init_job_table(struct job_table* table){
+/*
+Initializes an empty job table.
+
+Receives: struct job_table* table: The table to initialize.
+Returns: Nothing
+*/
+	table->jobs = NULL;
+	table->capacity = 0;
+	table->count = 0;
+	table->free_head = -1;
+	table->pid_index = NULL;
+	table->index_size = 0;
+	table->index_count = 0;
+	grow(table);
+	rebuild_index(table, 64);
+}
+
+struct job* add_job(struct job_table* table, pid_t* pids, int num_procs, const char* command){
+/*
+Adds a running job to the table, taking a slot from the free list.
+
+Receives: -struct job_table* table: The table.
+          -pid_t* pids: pids of the job's processes, in pipeline order.
+          -int num_procs: Number of pids, at least 1.
+          -const char* command: Command line of the job. A copy is stored.
+Returns: struct job*: The new job. Only valid until the next add_job().
+*/
+	struct job* job;
+	int slot;
+	int i;
+
+	if (table->free_head == -1)
+		grow(table);
+
+	// Keep the pid index at most half full.
+	if ((table->index_count + num_procs) * 2 > table->index_size)
+	{
+		i = table->index_size;
+		while ((table->index_count + num_procs) * 2 > i)
+			i *= 2;
+		rebuild_index(table, i);
+	}
+
+	// Take the first free slot.
+	slot = table->free_head;
+	job = &table->jobs[slot];
+	table->free_head = job->next_free;
+
+	job->pid = pids[0];
+	job->procs = malloc(num_procs * sizeof(struct job_proc));
+	job->num_procs = num_procs;
+	job->live_procs = num_procs;
+	job->wstatus = 0;
+	job->command = strdup(command);
+	job->state = JOB_RUNNING;
+	job->quiet = 0;
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+
+	for (i = 0; i < num_procs; i++)
+	{
+		job->procs[i].pid = pids[i];
+		job->procs[i].pidfd = -1;
+		job->procs[i].sample = NULL;
+		index_insert(table, pids[i], slot);
+	}
+	table->count++;
+
+	return job;
+}
+
+struct job* find_job_id(struct job_table* table, int id){
+/*
+Finds a job by its job id.
+
+Receives: -struct job_table* table: The table.
+          -int id: Job id, as used in %n.
+Returns: struct job*: The job, or NULL if there is no such job.
+*/
+	if (id < 1 || id > table->capacity || table->jobs[id - 1].state == JOB_FREE)
+		return NULL;
+
+	return &table->jobs[id - 1];
+}
+
+struct job* find_job_pid(struct job_table* table, pid_t pid, int* proc){
+/*
+Finds the job that a live process belongs to.
+
+Receives: -struct job_table* table: The table.
+          -pid_t pid: pid to look up.
+          -int* proc: If not NULL, set to the index of the process in the
+           job's procs array.
+Returns: struct job*: The job, or NULL if there is no such job.
+*/
+	unsigned int pos = pid_slot(table, pid);
+	struct job* job;
+	int i;
+
+	while (table->pid_index[pos].slot != 0)
+	{
+		if (table->pid_index[pos].pid == pid)
+		{
+			job = &table->jobs[table->pid_index[pos].slot - 1];
+			if (proc != NULL)
+			{
+				for (i = 0; job->procs[i].pid != pid; i++)
+					continue;
+				*proc = i;
+			}
+			return job;
+		}
+		pos = (pos + 1) & (table->index_size - 1);
+	}
+
+	return NULL;
+}
+
+void job_proc_done(struct job_table* table, struct job* job, int proc){
+/*
+Records that one process of a job has been cleaned up, and closes its
+jobstat sample. The caller is responsible for the process's pidfd.
+
+Receives: -struct job_table* table: The table.
+          -struct job* job: The job.
+          -int proc: Index of the process in job->procs.
+Returns: Nothing
+*/
+	index_remove(table, job->procs[proc].pid);
+	free_sample(job->procs[proc].sample);
+	job->procs[proc].pid = 0;
+	job->procs[proc].pidfd = -1;
+	job->procs[proc].sample = NULL;
+	job->live_procs--;
+}
+
+void remove_job(struct job_table* table, struct job* job){
+/*
+Removes a job from the table and frees its command line. The caller is
+responsible for the pidfds of processes that are still live. The slot is
+pushed onto the free list.
+
+Receives: -struct job_table* table: The table.
+          -struct job* job: The job to remove.
+Returns: Nothing
+*/
+	int i;
+
+	for (i = 0; i < job->num_procs; i++)
+	{
+		if (job->procs[i].pid != 0)
+			index_remove(table, job->procs[i].pid);
+		free_sample(job->procs[i].sample);
+	}
+
+	free(job->procs);
+	free(job->command);
+	job->procs = NULL;
+	job->command = NULL;
+	job->state = JOB_FREE;
+	job->next_free = table->free_head;
+	table->free_head = job->id - 1;
+	table->count--;
+}
+
+void free_job_table(struct job_table* table){
+/*
+Frees a job table and the jobs left in it. The caller is responsible for
+the processes of those jobs.
+
+Receives: struct job_table* table: The table.
+Returns: Nothing
+*/
+	int i;
+	int proc;
+
+	for (i = 0; i < table->capacity; i++)
+	{
+		for (proc = 0; table->jobs[i].procs != NULL && proc < table->jobs[i].num_procs; proc++)
+			free_sample(table->jobs[i].procs[proc].sample);
+		free(table->jobs[i].procs);
+		free(table->jobs[i].command);
+	}
+	free(table->jobs);
+	free(table->pid_index);
+	table->jobs = NULL;
+	table->pid_index = NULL;
+	table->capacity = 0;
+	table->count = 0;
+}
@@ -0,0 +1,72 @@
+#ifndef __JOB_TABLE_H__
+#define __JOB_TABLE_H__
+
+#include <sys/types.h>
+#include <time.h>
+
+enum job_state {
+	JOB_FREE,     // slot is unused
+	JOB_RUNNING,
+	JOB_STOPPED,
+	JOB_DONE      // QUIET_KEEP job that finished, kept until its owner removes it
+};
+
+// Quiet jobs belong to a builtin or to a process substitution. When a
+// QUIET_KEEP job is done, it is kept as JOB_DONE until its owner removes it.
+// A QUIET_REMOVE job is removed as soon as it is done.
+#define QUIET_KEEP 1
+#define QUIET_REMOVE 2
+
+struct proc_sample;
+
+// One process of a job. A pipeline has one per command.
+struct job_proc {
+	pid_t pid;              // 0 once the process has been cleaned up
+	int pidfd;              // pidfd watched by the event loop, -1 if unavailable
+	struct proc_sample* sample; // /proc files cached by jobstat, NULL if none
+};
+
+struct job {
+	int id;                 // job id used by %n, index in the table plus one
+	pid_t pid;              // pid of the first process, also the process group
+	struct job_proc* procs; // processes of the job, in pipeline order
+	int num_procs;
+	int live_procs;         // processes that have not been cleaned up yet
+	int wstatus;            // status of the last process, once it is done
+	char* command;          // command line, allocated
+	struct timespec start;  // CLOCK_MONOTONIC time the job was started
+	enum job_state state;
+	int quiet;              // not reported by the event loop: QUIET_KEEP or
+	                        // QUIET_REMOVE, 0 for a normal job
+	int next_free;          // index of the next free slot, -1 at the end
+};
+
+// Entry of the pid index. slot is the job's index plus one, 0 if empty.
+struct pid_entry {
+	pid_t pid;
+	int slot;
+};
+
+// Jobs are stored in a growable array indexed by job id, with a free list
+// of unused slots, and a hash index from the pid of every live process to
+// its job. Adding, finding and removing a job by id or pid are all constant
+// time (per process).
+struct job_table {
+	struct job* jobs;           // slots, jobs[id - 1] holds job id
+	int capacity;               // number of slots
+	int count;                  // number of running or stopped jobs
+	int free_head;              // first free slot, -1 if the table is full
+	struct pid_entry* pid_index;// open addressing hash of pid -> slot
+	int index_size;             // size of pid_index, a power of two
+	int index_count;            // number of entries in pid_index
+};
+
+void init_job_table(struct job_table* table);
+struct job* add_job(struct job_table* table, pid_t* pids, int num_procs, const char* command);
+struct job* find_job_id(struct job_table* table, int id);
+struct job* find_job_pid(struct job_table* table, pid_t pid, int* proc);
+void job_proc_done(struct job_table* table, struct job* job, int proc);
+void remove_job(struct job_table* table, struct job* job);
+void free_job_table(struct job_table* table);
+
+#endif // __JOB_TABLE_H__
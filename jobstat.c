@@ -0,0 +1,334 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "jobstat.h"
+#include "command_info.h"
+#include "job_table.h"
+#include "event_loop.h"
+
+// A sample taken less than this long ago is reused instead of read again.
+#define SAMPLE_MIN_MS 200
+
+// Seconds between refreshes of jobstat --watch, unless given.
+#define WATCH_INTERVAL 2
+
+// Last sample of one process, kept in its job_proc. The /proc files stay
+// open while the process is in the job table, and are read again with
+// pread(), so a sample costs three reads and no open(). The previous CPU
+// time gives the CPU % since the last sample. The sample is freed by the
+// job table when the process is cleaned up or its job removed.
+struct proc_sample {
+	int stat_fd;
+	int statm_fd;
+	int io_fd;                    // -1 if /proc/<pid>/io can't be read
+	unsigned long long starttime; // from stat, to tell a reused pid
+	struct timespec taken;        // CLOCK_MONOTONIC time of the sample
+	unsigned long cpu_ticks;      // utime + stime
+	double cpu_percent;
+	long rss;                     // bytes
+	long long read_bytes;         // rchar, -1 if unknown
+	long long write_bytes;        // wchar, -1 if unknown
+	long threads;
+};
+
+static long elapsed_ms(const struct timespec* from, const struct timespec* to){
+	return (to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+static ssize_t read_proc(int fd, char* buffer, size_t size){
+/*
+Reads a /proc file from the start into a null terminated buffer.
+
+Receives: -int fd: The open file.
+          -char* buffer: Where to read.
+          -size_t size: Size of buffer.
+Returns: ssize_t: Number of chars read, or -1 on an error.
+*/
+	ssize_t num_read = pread(fd, buffer, size - 1, 0);
+
+	if (num_read >= 0)
+		buffer[num_read] = '\0';
+	return num_read;
+}
+
+void free_sample(struct proc_sample* sample){
+/*
+Closes the /proc files of a process's sample and frees it.
+
+Receives: struct proc_sample* sample: The sample, or NULL.
+Returns: Nothing
+*/
+	if (sample == NULL)
+		return;
+	close(sample->stat_fd);
+	close(sample->statm_fd);
+	if (sample->io_fd != -1)
+		close(sample->io_fd);
+	free(sample);
+}
+
+static struct proc_sample* find_sample(struct job_proc* proc){
+/*
+Finds the cached sample of a process, opening its /proc files if it has
+none yet.
+
+Receives: struct job_proc* proc: The process, in its job.
+Returns: struct proc_sample*: Its sample, or NULL if the process is gone
+                              or there is no memory for the sample.
+*/
+	struct proc_sample* sample;
+	char path[64];
+
+	if (proc->sample != NULL)
+		return proc->sample;
+
+	// Without memory for a new sample, the process is skipped like one
+	// that is gone.
+	if ((sample = calloc(1, sizeof(struct proc_sample))) == NULL)
+		return NULL;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int) proc->pid);
+	if ((sample->stat_fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		free(sample);
+		return NULL;
+	}
+	snprintf(path, sizeof(path), "/proc/%d/statm", (int) proc->pid);
+	if ((sample->statm_fd = open(path, O_RDONLY | O_CLOEXEC)) == -1)
+	{
+		close(sample->stat_fd);
+		free(sample);
+		return NULL;
+	}
+	snprintf(path, sizeof(path), "/proc/%d/io", (int) proc->pid);
+	sample->io_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	proc->sample = sample;
+	return sample;
+}
+
+static int take_sample(struct proc_sample* sample, const struct timespec* job_start,
+	const struct timespec* now){
+/*
+Reads a process's stat, statm and io files, unless its sample is recent
+enough. The CPU % is over the time since the last sample, or since the job
+started for the first one.
+
+Receives: -struct proc_sample* sample: The process's sample.
+          -const struct timespec* job_start: When the job started.
+          -const struct timespec* now: The current CLOCK_MONOTONIC time.
+Returns: int: 0 if successful, -1 if the process is gone.
+*/
+	char buffer[1024];
+	unsigned long utime;
+	unsigned long stime;
+	unsigned long long starttime;
+	unsigned long cpu_ticks;
+	long threads;
+	long resident;
+	long interval;
+	long long value;
+	char* stats;
+	char* line;
+
+	if (sample->taken.tv_sec != 0 && elapsed_ms(&sample->taken, now) < SAMPLE_MIN_MS)
+		return 0;
+
+	// The command name in stat may hold spaces and parentheses, so the
+	// fields are read from after the last ')'.
+	if (read_proc(sample->stat_fd, buffer, sizeof(buffer)) <= 0
+		|| (stats = strrchr(buffer, ')')) == NULL
+		|| sscanf(stats + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %ld %*d %llu",
+			&utime, &stime, &threads, &starttime) != 4)
+		return -1;
+
+	// A different start time means the pid was reused, so the previous
+	// sample is not this process's.
+	if (sample->taken.tv_sec != 0 && starttime != sample->starttime)
+		return -1;
+
+	cpu_ticks = utime + stime;
+	if (sample->taken.tv_sec == 0)
+		interval = elapsed_ms(job_start, now);
+	else
+		interval = elapsed_ms(&sample->taken, now);
+	if (interval > 0)
+		sample->cpu_percent = (cpu_ticks - sample->cpu_ticks) * 100000.0 / sysconf(_SC_CLK_TCK) / interval;
+
+	sample->starttime = starttime;
+	sample->cpu_ticks = cpu_ticks;
+	sample->threads = threads;
+	sample->taken = *now;
+
+	if (read_proc(sample->statm_fd, buffer, sizeof(buffer)) > 0
+		&& sscanf(buffer, "%*d %ld", &resident) == 1)
+		sample->rss = resident * sysconf(_SC_PAGESIZE);
+
+	// io is only readable for processes of the same user.
+	sample->read_bytes = -1;
+	sample->write_bytes = -1;
+	if (sample->io_fd != -1 && read_proc(sample->io_fd, buffer, sizeof(buffer)) > 0)
+	{
+		for (line = strtok(buffer, "\n"); line != NULL; line = strtok(NULL, "\n"))
+		{
+			if (sscanf(line, "rchar: %lld", &value) == 1)
+				sample->read_bytes = value;
+			else if (sscanf(line, "wchar: %lld", &value) == 1)
+				sample->write_bytes = value;
+		}
+	}
+
+	return 0;
+}
+
+static char* format_bytes(long long bytes, char* buffer){
+/*
+Formats a number of bytes with a K, M or G suffix.
+
+Receives: -long long bytes: The number, -1 if unknown.
+          -char* buffer: Filled with the text, at least 16 chars.
+Returns: char*: buffer.
+*/
+	const char* units = "KMGT";
+	double value = bytes;
+	int unit = -1;
+
+	if (bytes < 0)
+		return strcpy(buffer, "-");
+
+	while (value >= 1024 && unit < 3)
+	{
+		value /= 1024;
+		unit++;
+	}
+
+	if (unit == -1)
+		sprintf(buffer, "%lldB", bytes);
+	else
+		sprintf(buffer, "%.1f%c", value, units[unit]);
+	return buffer;
+}
+
+static void print_jobstat(struct job_table* jobs){
+/*
+Prints one line per running or stopped job with the CPU %, RSS, bytes read
+and written, threads and elapsed time of its processes, summed over a
+pipeline.
+
+Receives: struct job_table* jobs: The job table.
+Returns: Nothing
+*/
+	struct proc_sample* sample;
+	struct timespec now;
+	struct job* job;
+	char id[16];
+	char rss[16];
+	char read_bytes[16];
+	char write_bytes[16];
+	double cpu_percent;
+	long long total_rss;
+	long long total_read;
+	long long total_write;
+	long threads;
+	long elapsed;
+	int i;
+	int proc;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	printf("%-5s %-7s %6s %8s %8s %8s %4s %9s %s\n",
+		"JOB", "PID", "CPU%", "RSS", "READ", "WRITE", "THR", "ELAPSED", "COMMAND");
+
+	for (i = 0; i < jobs->capacity; i++)
+	{
+		job = &jobs->jobs[i];
+		if (job->state == JOB_FREE || job->state == JOB_DONE)
+			continue;
+
+		cpu_percent = 0;
+		total_rss = 0;
+		total_read = 0;
+		total_write = 0;
+		threads = 0;
+		for (proc = 0; proc < job->num_procs; proc++)
+		{
+			if (job->procs[proc].pid == 0
+				|| (sample = find_sample(&job->procs[proc])) == NULL)
+				continue;
+
+			// A process that is gone, or a reused pid, is read again next
+			// time from a new sample.
+			if (take_sample(sample, &job->start, &now) == -1)
+			{
+				free_sample(sample);
+				job->procs[proc].sample = NULL;
+				continue;
+			}
+
+			cpu_percent += sample->cpu_percent;
+			total_rss += sample->rss;
+			threads += sample->threads;
+			if (total_read != -1)
+				total_read = (sample->read_bytes == -1) ? -1 : total_read + sample->read_bytes;
+			if (total_write != -1)
+				total_write = (sample->write_bytes == -1) ? -1 : total_write + sample->write_bytes;
+		}
+
+		elapsed = now.tv_sec - job->start.tv_sec;
+		sprintf(id, "[%d]", job->id);
+		printf("%-5s %-7d %6.1f %8s %8s %8s %4ld %3ld:%02ld:%02ld %s\n", id, job->pid,
+			cpu_percent, format_bytes(total_rss, rss), format_bytes(total_read, read_bytes),
+			format_bytes(total_write, write_bytes), threads,
+			elapsed / 3600, (elapsed / 60) % 60, elapsed % 60, job->command);
+	}
+	fflush(stdout);
+}
+
+int jobstat_command(struct job_table* jobs, struct command_info* command){
+/*
+Built in "jobstat" command: jobstat [--watch [SECONDS]]. Prints the
+resource use of every background job, read from /proc. With --watch, the
+table is printed again every SECONDS (2 by default) until a line is
+entered or no job is left. Jobs that finish in the meantime are reported
+as usual.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct command_info* command: The command, starting with "jobstat".
+Returns: int: Termination status for the status builtin.
+*/
+	int interval = 0;
+	int events;
+
+	if (command->args[1] != NULL && strcmp(command->args[1], "--watch") == 0)
+	{
+		interval = WATCH_INTERVAL;
+		if (command->args[2] != NULL)
+			interval = atoi(command->args[2]);
+	}
+
+	if ((command->args[1] != NULL && interval <= 0)
+		|| (command->args[1] != NULL && command->args[2] != NULL && command->args[3] != NULL))
+	{
+		printf("usage: jobstat [--watch [SECONDS]]\n");
+		fflush(stdout);
+		return W_EXITCODE(2, 0);
+	}
+
+	while (1)
+	{
+		print_jobstat(jobs);
+		if (interval == 0 || jobs->count == 0)
+			return 0;
+
+		// Wait for the next refresh. A job that ends refreshes the table
+		// early, and input or a signal stops watching.
+		events = wait_events(interval * 1000, jobs);
+		if (events == -1 || (events & EVENT_INPUT))
+			return 0;
+		printf("\n");
+	}
+}
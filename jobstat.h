@@ -0,0 +1,10 @@
+#ifndef __JOBSTAT_H__
+#define __JOBSTAT_H__
+
+#include "job_table.h"
+#include "command_info.h"
+
+void free_sample(struct proc_sample* sample);
+int jobstat_command(struct job_table* jobs, struct command_info* command);
+
+#endif // __JOBSTAT_H__
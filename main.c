@@ -5,6 +5,14 @@
 //              input, parsing PIDs, cleaning up zombie processes,
 //              redirecting input/output, and handling SIGINT and
 //              SIGTSTP signals.
+//
+// Usage: smallsh [-e] [-c commands | script]
+//        With no arguments, commands are read interactively from stdin.
+//        -c runs the given commands and script runs the commands in a
+//        file, without prompting. -e exits on the first command that
+//        fails.
+
+#define _GNU_SOURCE
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -12,125 +20,182 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
+#include <unistd.h>
 #include "command_info.h"
 #include "input_funcs.h"
 #include "shell_process.h"
-#include "list_node.h"
-
-// Global variable. If 0, we are in normal mode where bg and fg commands
-// can execute. If 1, only fg commands will execute. This value is changed
-// by the handler for the SIGTSTP signal.
-int fg_only_mode = 0;
-
-int main(void){
+#include "job_table.h"
+#include "arena.h"
+#include "event_loop.h"
+#include "stats.h"
+#include "placement.h"
+#include "shell_context.h"
+
+int main(int argc, char** argv){
 	char* validated_str;
+	char* command_string = NULL;
 	struct command_info curr_command; 
-	pid_t pid_result;
-	struct pid_node* head = NULL;
-	struct pid_node* tail = NULL;
-	struct pid_node* new_node;
+	struct command_info* command;
+	struct smallsh shell;
+	struct arena command_arena;
+
+	int events = 0;
+	int parse_result;
+	int interactive = 1;
+	int exit_on_error = 0;
+	int opt;
+
+	// Parse the command-line options. -c and a script file both turn off
+	// interactive mode: no prompt and no interactive signal handling.
+	while ((opt = getopt(argc, argv, "+ec:")) != -1)
+	{
+		if (opt == 'e')
+			exit_on_error = 1;
+		else if (opt == 'c')
+			command_string = optarg;
+		else
+		{
+			fprintf(stderr, "usage: smallsh [-e] [-c commands | script]\n");
+			exit(2);
+		}
+	}
 
-	int last_status = 0; 
+	if (command_string != NULL)
+	{
+		input_from_string(command_string);
+		interactive = 0;
+	}
+
+	else if (optind < argc)
+	{
+		if (input_from_file(argv[optind]) == -1)
+		{
+			perror(argv[optind]);
+			exit(127);
+		}
+		interactive = 0;
+	}
+
+	// Set up the shell's context: its job table, the spawn engine, the
+	// builtins, the trace and the event loop. Without a prompt, the shell
+	// never waits for stdin. The context's fg_only_mode is changed by the
+	// handler for the SIGTSTP signal.
+	if (init_smallsh(&shell, interactive) == -1)
+	{
+		perror("smallsh");
+		exit(1);
+	}
 
 	// Initialize sigaction structs for signals that affect the parent process
 	struct sigaction sigtstp_action = {0};
 	struct sigaction sigint_action = {0};
 
-	// Create SIGINT signal handler (will be ignored by parent)
-	make_sigint_struct(&sigint_action);
-	sigaction(SIGINT, &sigint_action, NULL);
-
-	// Create SIGTSTP signal handler (will be handled by parent, not ignored)	
-	make_sigtstp_struct(&sigtstp_action);
-	sigaction(SIGTSTP, &sigtstp_action, NULL);
+	// The interactive signal handlers are only installed in interactive
+	// mode. A script can be interrupted like any other program.
+	if (interactive)
+	{
+		// Create SIGINT signal handler (will be ignored by parent)
+		make_sigint_struct(&sigint_action);
+		sigaction(SIGINT, &sigint_action, NULL);
 
-	do{
-		// Each time before the prompt is presented to the user, cleanup_bg
-		// cleanups all background processes that have terminated.
-		cleanup_bg(head, &head, &tail);
-
-		// Present prompt to user
-		printf(": ");
-		fflush(stdout);
-
-		// Get user's command-line input. If it is just white spaces
-		// or a comment, go back to start of loop and re-prompt by
-		// calling continue.
-		if ((validated_str = arg_str()) == NULL)
-			continue;
+		// Create SIGTSTP signal handler (will be handled by parent, not ignored)	
+		make_sigtstp_struct(&sigtstp_action, &shell.fg_only_mode);
+		sigaction(SIGTSTP, &sigtstp_action, NULL);
+	}
 
-		// If this point is reached, a dynamically allocated user command
-		// string is stored in validated_str. We call tokenize to break
-		// the string into a structure that will hold the command args,
-		// i/o redirection filenames and a background/foreground flag.
-		tokenize(validated_str, &curr_command);
+	// The line, tokens and pipeline stages of each command are allocated
+	// from one arena, which is reset before the next command is read.
+	init_arena(&command_arena);
 
-		// This if statement and the following two else if statements
-		// are for built in functions. If the user's command was
-		// status, call the status function. When status is done return
-		// to prompt.
-		if (strcmp(curr_command.args[0], "status") == 0)
-		{
-			status(last_status);
-			continue;
-		}
+	do{
+		// Release the memory of the previous command.
+		arena_reset(&command_arena);
 
-		// If user's command was cd, call the built in change_dir 
-		// function, and when it's done return to prompt.
-		else if (strcmp(curr_command.args[0], "cd") == 0)
+		// In script mode there is no prompt and no waiting for input. Only
+		// check for finished background jobs, and only if there are any.
+		if (!interactive)
 		{
-			change_dir(&curr_command);
-			continue;
+			if (shell.jobs.count > 0)
+				wait_events(0, &shell.jobs);
 		}
 
-		// If user's command was exit, call the built in exit_shell
-		// function, which will exit the shell.
-		else if (strcmp(curr_command.args[0], "exit") == 0)
-			exit_shell(head);
-
-		// If this point is reached, the user did NOT call a built in
-		// function, so we have to fork off a new process. If we are
-		// in normal more and the struct's background flag is set,
-		// run a background process.
-		if (curr_command.background && fg_only_mode == 0)
+		else
 		{
-			// Start the background command. The pid of the new bg command
-			// is saved in pid_result.
-			pid_result = bg_proc(&curr_command);
+			// Before the prompt is presented to the user, report all background
+			// processes that have already terminated.
+			wait_events(0, &shell.jobs);
 
-			// This will only happen if there is a fork error.
-			if (pid_result == -1)
-			{
-				continue;	
-			}
+			// Present prompt to user
+			printf(": ");
+			fflush(stdout);
 
-			// Create a new linked list node from the new bg pid.
-			new_node = add_node(pid_result);	
-			
-			// Add the new node into the linked list of bg process IDs.
-			if (head == NULL)
+			// Wait for a complete line of input. Background processes that
+			// terminate in the meantime are cleaned up and reported as soon as
+			// they finish, after which the prompt is shown again. If a signal
+			// interrupts the wait, go back to the start of the loop and re-prompt.
+			events = 0;
+			while (!input_pending())
 			{
-				head = new_node;
-				tail = new_node;
+				events = wait_events(-1, &shell.jobs);
+				if (events == -1 || (events & EVENT_INPUT))
+					break;
+				if (events & EVENT_REAPED)
+				{
+					printf(": ");
+					fflush(stdout);
+				}
 			}
+			if (events == -1)
+				continue;
+		}
 
-			else
+		// Get user's command-line input. If it is just white spaces
+		// or a comment, go back to start of loop and re-prompt by
+		// calling continue. At the end of the input, exit the shell. A
+		// script first waits for its background jobs to finish.
+		STAT_START(command_start);
+		validated_str = arg_str(&command_arena);
+		STAT_END(STAT_READ, command_start);
+		if (validated_str == NULL)
+		{
+			if (input_eof())
 			{
-				tail->next = new_node;
-				tail = new_node;
+				while (!interactive && shell.jobs.count > 0)
+					wait_events(-1, &shell.jobs);
+				exit_shell(&shell.jobs, exit_value(shell.last_status));
 			}
+			continue;
 		}
 
-		// If we are in foreground-only mode or if the background flag of the struct
-		// was not set, we will run a foreground command.
-		else
+		// If this point is reached, the user command string is stored in
+		// validated_str, in the command arena. We call tokenize to break
+		// the string into a structure that will hold the command args,
+		// i/o redirection filenames and a background/foreground flag.
+		STAT_START(parse_start);
+		parse_result = tokenize(validated_str, &curr_command, &command_arena);
+		STAT_END(STAT_PARSE, parse_start);
+		// The bodies of here-documents are the lines after the command.
+		if (parse_result != -1)
+			parse_result = read_heredocs(&curr_command, &command_arena);
+
+		// Placement prefix words (pin, nice, sched, ionice) are removed from
+		// each pipeline and kept for the spawn engine.
+		for (command = &curr_command; command != NULL && parse_result != -1; command = command->next_command)
+			parse_result = parse_placement(command, &command_arena);
+		// A syntax error sets the status to 2, as in sh. Without a prompt
+		// there is no one to correct the line, so -c and scripts stop.
+		if (parse_result == -1)
 		{
-			// The parent process must wait for the foreground process to terminate,
-			// so last_status will hold the termination status of the child.
-			last_status = fg_proc(&curr_command);
-			fflush(stdout);
+			shell.last_status = W_EXITCODE(2, 0);
+			if (exit_on_error || !interactive)
+				exit_shell(&shell.jobs, 2);
+			continue;
 		}
 
+		// Run the pipelines of the command list from left to right. With
+		// -e, the first command that fails ends the shell.
+		run_list(&shell, &curr_command, &command_arena, exit_on_error);
+
 	} while(1);
 
 	return 0;
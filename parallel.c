@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "parallel.h"
+#include "job_runner.h"
+#include "command_info.h"
+#include "job_table.h"
+#include "spawn_engine.h"
+#include "input_funcs.h"
+
+// Placeholder in the command template that is replaced by each input line.
+#define PLACEHOLDER "{}"
+
+// The exit value of parallel is the number of failed jobs, up to this limit.
+#define MAX_FAILED 101
+
+// What next_job() needs to start the job of each input line.
+struct parallel_input {
+	FILE* file;                // -a or < file, or NULL for stdin
+	char** template;           // command template
+	int num_args;              // number of template arguments
+	struct proc_subst* subst;  // process substitutions of the command
+};
+
+static char* substitute(const char* arg, const char* line){
+/*
+Replaces every {} in a template argument with an input line.
+
+Receives: -const char* arg: The template argument.
+          -const char* line: The input line.
+Returns: char*: The new argument, allocated, or NULL if arg has no {}.
+*/
+	const char* match;
+	char* result;
+	size_t line_len = strlen(line);
+	size_t size = strlen(arg) + 1;
+	size_t len = 0;
+
+	if (strstr(arg, PLACEHOLDER) == NULL)
+		return NULL;
+
+	// Work out the size of the result first.
+	for (match = arg; (match = strstr(match, PLACEHOLDER)) != NULL; match += 2)
+		size += line_len - 2;
+	result = malloc(size);
+
+	while ((match = strstr(arg, PLACEHOLDER)) != NULL)
+	{
+		memcpy(result + len, arg, match - arg);
+		len += match - arg;
+		memcpy(result + len, line, line_len);
+		len += line_len;
+		arg = match + 2;
+	}
+	strcpy(result + len, arg);
+
+	return result;
+}
+
+static ssize_t next_arg(FILE* input, char** line){
+/*
+Reads the next non-empty input line, without its newline.
+
+Receives: -FILE* input: File given with -a or <, or NULL to read stdin.
+          -char** line: Set to the line. It is only valid until the next
+           call.
+Returns: ssize_t: Length of the line, or -1 at end of input.
+*/
+	static char* buffer = NULL;
+	static size_t size = 0;
+	ssize_t line_len;
+
+	do
+	{
+		if (input != NULL)
+		{
+			line_len = getline(&buffer, &size, input);
+			*line = buffer;
+		}
+		else
+			line_len = data_line(line);
+
+		if (line_len == -1)
+			return -1;
+
+		// Lines from stdin point into the shell's input buffer, so they are
+		// copied before the newline is removed.
+		if (input == NULL)
+		{
+			if (size < (size_t) line_len + 1)
+			{
+				size = line_len + 1;
+				buffer = realloc(buffer, size);
+			}
+			memcpy(buffer, *line, line_len);
+			*line = buffer;
+		}
+		if (line_len > 0 && buffer[line_len - 1] == '\n')
+			line_len--;
+		buffer[line_len] = '\0';
+	} while (line_len == 0);
+
+	return line_len;
+}
+
+static struct job* start_job(struct job_table* jobs, char** template, int num_args, const char* line,
+	struct proc_subst* subst){
+/*
+Starts one job: the template with the input line substituted, or appended
+if the template has no {}. The job reads /dev/null and never the terminal.
+
+Receives: -struct job_table* jobs: The job table.
+          -char** template: Arguments of the command template.
+          -int num_args: Number of template arguments.
+          -const char* line: The input line.
+          -struct proc_subst* subst: Process substitutions the template
+           can name, from the parallel command.
+Returns: struct job*: The new job, or NULL if it could not be started.
+*/
+	struct command_info job_command = {0};
+	char* copies[num_args];
+	char* job_args[num_args + 2];
+	struct job* job;
+	int placeholders = 0;
+	int i;
+
+	job_command.args = job_args;
+	job_command.max_args = num_args + 2;
+	for (i = 0; i < num_args; i++)
+	{
+		copies[i] = substitute(template[i], line);
+		job_command.args[i] = copies[i] ? copies[i] : template[i];
+		if (copies[i] != NULL)
+			placeholders++;
+	}
+	job_args[num_args] = NULL;
+	job_args[num_args + 1] = NULL;
+	if (placeholders == 0)
+		job_command.args[num_args] = (char*) line;
+
+	job_command.subst = subst;
+	job = start_quiet_job(jobs, &job_command, 1);
+
+	for (i = 0; i < num_args; i++)
+		free(copies[i]);
+
+	return job;
+}
+
+static int next_job(struct job_table* jobs, void* data, struct job** job){
+/*
+Starts the job for the next input line, for run_quiet_jobs().
+
+Receives: -struct job_table* jobs: The job table.
+          -void* data: The struct parallel_input of the command.
+          -struct job** job: Set to the new job, or NULL.
+Returns: int: 0 at the end of the input, 1 otherwise.
+*/
+	struct parallel_input* input = data;
+	char* line;
+
+	if (next_arg(input->file, &line) == -1)
+		return 0;
+
+	*job = start_job(jobs, input->template, input->num_args, line, input->subst);
+	return 1;
+}
+
+static void report_job(int report_fd, struct job* job){
+/*
+Prints the exit value of a finished job, or the signal that terminated it.
+
+Receives: -int report_fd: Where to print, the shell's stdout.
+          -struct job* job: The job.
+Returns: Nothing
+*/
+	if (WIFEXITED(job->wstatus))
+		dprintf(report_fd, "parallel: %s: exit value %d\n", job->command,
+			WEXITSTATUS(job->wstatus));
+	else
+		dprintf(report_fd, "parallel: %s: terminated by signal %d\n", job->command,
+			WTERMSIG(job->wstatus));
+}
+
+int parallel_command(struct job_table* jobs, struct command_info* command){
+/*
+Built in "parallel" command: parallel [-j N] [-a file] command [args]
+Runs the command once for every line of input, with {} in its arguments
+replaced by the line (or the line added as the last argument if there is
+no {}). Lines are read from the -a file, the < file, or stdin. Exactly N
+jobs (default: one per CPU, at most MAX_JOBS) are kept running, and the
+next one is started as soon as one finishes. The jobs are tracked in the
+shell's job table and the exit value of each is reported. A > redirection
+applies to the output of all jobs.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct command_info* command: The parallel command.
+Returns: int: Termination status for the status builtin. The exit value is
+              the number of jobs that failed, at most 101.
+*/
+	struct parallel_input input = {0};
+	char* input_file = command->stdin_file;
+	char* count = NULL;
+	int max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	int failed;
+	int data_fd;
+	int i = 1;
+
+	// Options come before the command template.
+	while (command->args[i] != NULL && command->args[i][0] == '-')
+	{
+		if (strcmp(command->args[i], "-j") == 0 && command->args[i + 1] != NULL)
+			count = command->args[++i];
+		else if (strncmp(command->args[i], "-j", 2) == 0 && command->args[i][2] != '\0')
+			count = command->args[i] + 2;
+		else if (strcmp(command->args[i], "-a") == 0 && command->args[i + 1] != NULL)
+			input_file = command->args[++i];
+		else
+			break;
+		i++;
+	}
+
+	input.template = &command->args[i];
+	for (input.num_args = 0; input.template[input.num_args] != NULL; input.num_args++)
+		continue;
+	input.subst = command->subst;
+
+	if (count != NULL && (max_jobs = job_count(count)) == 0)
+	{
+		printf("parallel: %s: number of jobs must be 1 to %d\n", count, MAX_JOBS);
+		fflush(stdout);
+		return 1 << 8;
+	}
+
+	// The CPU count can be unknown, or above the limit.
+	if (max_jobs < 1)
+		max_jobs = 1;
+	else if (max_jobs > MAX_JOBS)
+		max_jobs = MAX_JOBS;
+
+	if (input.num_args == 0)
+	{
+		printf("usage: parallel [-j N] [-a file] command [args]\n");
+		fflush(stdout);
+		return 1 << 8;
+	}
+
+	// Lines can also come from a here-document or here-string.
+	if (input_file == NULL && command->stdin_data != NULL)
+	{
+		if ((data_fd = open_stdin_data(command->stdin_data)) == -1)
+			return 1 << 8;
+		input.file = fdopen(data_fd, "r");
+	}
+
+	if (input_file != NULL && (input.file = fopen(input_file, "r")) == NULL)
+	{
+		perror(input_file);
+		fflush(stdout);
+		return 1 << 8;
+	}
+
+	failed = run_quiet_jobs(jobs, command->stdout_file, max_jobs, next_job, report_job, &input);
+	if (input.file != NULL)
+		fclose(input.file);
+
+	// Returned in the format of a waitpid() status.
+	if (failed == -1)
+		return 1 << 8;
+	if (failed > MAX_FAILED)
+		failed = MAX_FAILED;
+	return failed << 8;
+}
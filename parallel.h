@@ -0,0 +1,9 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include "job_table.h"
+#include "command_info.h"
+
+int parallel_command(struct job_table* jobs, struct command_info* command);
+
+#endif // __PARALLEL_H__
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "path_cache.h"
+
+// Cache of absolute paths of commands found on PATH, so each command is
+// only searched for once instead of on every exec. Entries are chained in
+// a hash table keyed by command name.
+struct path_entry {
+	char* name;
+	char* path;
+	unsigned int hits;
+	struct path_entry* next;
+};
+
+static struct path_entry** buckets = NULL;
+static unsigned int num_buckets = 0;
+static unsigned int num_entries = 0;
+
+// Copy of PATH when the cache was filled. If PATH changes, the cache is
+// cleared.
+static char* cached_path_var = NULL;
+
+static unsigned int hash_name(const char* name){
+/*
+FNV-1a hash of a command name.
+
+Receives: const char* name: The command name.
+Returns: unsigned int: The hash.
+*/
+	unsigned int hash = 2166136261u;
+
+	while (*name)
+	{
+		hash ^= (unsigned char) *name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static void grow(void){
+/*
+Doubles the number of buckets and moves every entry to its new bucket.
+
+Receives: Nothing
+Returns: Nothing
+*/
+	struct path_entry** old_buckets = buckets;
+	struct path_entry* entry;
+	struct path_entry* next;
+	unsigned int old_num = num_buckets;
+	unsigned int i, pos;
+
+	num_buckets = old_num ? old_num * 2 : 64;
+	buckets = calloc(num_buckets, sizeof(struct path_entry*));
+
+	for (i = 0; i < old_num; i++)
+	{
+		for (entry = old_buckets[i]; entry != NULL; entry = next)
+		{
+			next = entry->next;
+			pos = hash_name(entry->name) & (num_buckets - 1);
+			entry->next = buckets[pos];
+			buckets[pos] = entry;
+		}
+	}
+
+	free(old_buckets);
+}
+
+static char* search_path(const char* name, const char* path_var){
+/*
+Searches the directories of PATH, in order, for an executable regular
+file with the given name. This is the search execvp() does on every call.
+
+Receives: -const char* name: The command name, without any '/'.
+          -const char* path_var: Value of PATH.
+Returns: char*: Allocated absolute path, or NULL if not found.
+*/
+	struct stat info;
+	const char* dir = path_var;
+	const char* end;
+	size_t dir_len;
+	size_t name_len = strlen(name);
+	char* candidate;
+
+	while (1)
+	{
+		end = strchr(dir, ':');
+		dir_len = (end != NULL) ? (size_t) (end - dir) : strlen(dir);
+
+		// An empty PATH entry means the current directory.
+		candidate = malloc(dir_len + name_len + 3);
+		if (dir_len == 0)
+			sprintf(candidate, "./%s", name);
+		else
+			sprintf(candidate, "%.*s/%s", (int) dir_len, dir, name);
+
+		if (stat(candidate, &info) == 0 && S_ISREG(info.st_mode) &&
+			access(candidate, X_OK) == 0)
+			return candidate;
+
+		free(candidate);
+		if (end == NULL)
+			return NULL;
+		dir = end + 1;
+	}
+}
+
+const char* lookup_command(const char* name){
+/*
+Finds the path to execute for a command. Names containing a '/' are used as
+they are. Other names are looked up in the cache, and searched for on PATH
+on a miss. The cache is cleared first if PATH changed since it was filled.
+
+Receives: const char* name: The command name (args[0]).
+Returns: const char*: Path to pass to execve(), owned by the cache, or NULL
+                      if the command was not found. In that case the caller
+                      should fall back to execvp(), which reports the error.
+*/
+	struct path_entry* entry;
+	const char* path_var;
+	unsigned int pos;
+	char* path;
+
+	if (strchr(name, '/') != NULL)
+		return name;
+
+	// Clear the cache if PATH changed.
+	path_var = getenv("PATH");
+	if (path_var == NULL)
+		path_var = "/bin:/usr/bin";
+	if (cached_path_var == NULL || strcmp(cached_path_var, path_var) != 0)
+	{
+		clear_path_cache();
+		free(cached_path_var);
+		cached_path_var = strdup(path_var);
+	}
+
+	if (buckets == NULL)
+		grow();
+
+	pos = hash_name(name) & (num_buckets - 1);
+	for (entry = buckets[pos]; entry != NULL; entry = entry->next)
+	{
+		if (strcmp(entry->name, name) == 0)
+		{
+			entry->hits++;
+			return entry->path;
+		}
+	}
+
+	// Miss. Only commands that were found are cached.
+	if ((path = search_path(name, path_var)) == NULL)
+		return NULL;
+
+	if (num_entries >= num_buckets)
+	{
+		grow();
+		pos = hash_name(name) & (num_buckets - 1);
+	}
+
+	entry = malloc(sizeof(struct path_entry));
+	entry->name = strdup(name);
+	entry->path = path;
+	entry->hits = 1;
+	entry->next = buckets[pos];
+	buckets[pos] = entry;
+	num_entries++;
+
+	return path;
+}
+
+void forget_command(const char* name){
+/*
+Removes a command from the cache. Called when its cached path turns out
+to no longer exist, so the next lookup searches PATH again.
+
+Receives: const char* name: The command name.
+Returns: Nothing
+*/
+	struct path_entry** link;
+	struct path_entry* entry;
+
+	if (buckets == NULL)
+		return;
+
+	for (link = &buckets[hash_name(name) & (num_buckets - 1)]; *link != NULL; link = &(*link)->next)
+	{
+		entry = *link;
+		if (strcmp(entry->name, name) == 0)
+		{
+			*link = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+			num_entries--;
+			return;
+		}
+	}
+}
+
+void clear_path_cache(void){
+/*
+Removes every command from the cache.
+
+Receives: Nothing
+Returns: Nothing
+*/
+	struct path_entry* entry;
+	struct path_entry* next;
+	unsigned int i;
+
+	for (i = 0; i < num_buckets; i++)
+	{
+		for (entry = buckets[i]; entry != NULL; entry = next)
+		{
+			next = entry->next;
+			free(entry->name);
+			free(entry->path);
+			free(entry);
+		}
+		buckets[i] = NULL;
+	}
+	num_entries = 0;
+}
+
+void print_path_cache(void){
+/*
+Prints every cached command with its number of hits and path.
+
+Receives: Nothing
+Returns: Nothing
+*/
+	struct path_entry* entry;
+	unsigned int i;
+
+	if (num_entries == 0)
+	{
+		printf("hash: hash table empty\n");
+		fflush(stdout);
+		return;
+	}
+
+	printf("hits\tcommand\n");
+	for (i = 0; i < num_buckets; i++)
+	{
+		for (entry = buckets[i]; entry != NULL; entry = entry->next)
+			printf("%4u\t%s\n", entry->hits, entry->path);
+	}
+	fflush(stdout);
+}
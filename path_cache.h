@@ -0,0 +1,9 @@
+#ifndef __PATH_CACHE_H__
+#define __PATH_CACHE_H__
+
+const char* lookup_command(const char* name);
+void forget_command(const char* name);
+void clear_path_cache(void);
+void print_path_cache(void);
+
+#endif // __PATH_CACHE_H__
@@ -0,0 +1,220 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "placement.h"
+#include "command_info.h"
+#include "arena.h"
+#include "builtins.h"
+
+// ioprio_set() has no glibc wrapper. These match linux/ioprio.h.
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+static int parse_cpus(const char* list, cpu_set_t* cpus){
+/*
+Parses a CPU list such as "2-5" or "0,2,4-6".
+
+Receives: -const char* list: The list.
+          -cpu_set_t* cpus: Filled with the CPUs in the list.
+Returns: int: 0 if successful, -1 if the list is not valid.
+*/
+	char* end;
+	long first;
+	long last;
+
+	CPU_ZERO(cpus);
+	while (1)
+	{
+		first = strtol(list, &end, 10);
+		if (end == list || first < 0)
+			return -1;
+		last = first;
+		if (*end == '-')
+		{
+			list = end + 1;
+			last = strtol(list, &end, 10);
+			if (end == list || last < first)
+				return -1;
+		}
+		if (last >= CPU_SETSIZE)
+			return -1;
+
+		for (; first <= last; first++)
+			CPU_SET(first, cpus);
+
+		if (*end == '\0')
+			return 0;
+		if (*end != ',')
+			return -1;
+		list = end + 1;
+	}
+}
+
+static int is_number(const char* word){
+	char* end;
+
+	strtol(word, &end, 10);
+	return *word != '\0' && *end == '\0';
+}
+
+int parse_placement(struct command_info* command, struct arena* arena){
+/*
+Removes the placement prefix words from the start of a command and stores
+them in command->placement, allocated from the command's arena:
+  pin CPUS           run on the listed CPUs only (e.g. 2-5 or 0,2,4-6)
+  nice N             add N to the nice value
+  sched batch|idle   use SCHED_BATCH or SCHED_IDLE
+  ionice N|idle      best-effort I/O priority N (0-7), or the idle class
+nice and ionice are only prefixes when followed by a number (or idle), so
+the nice and ionice programs can still be run with their own options. The
+words must be followed by the command, which can't be a builtin that runs
+in the shell itself (cd, jobs, ...).
+
+Receives: -struct command_info* command: The parsed command.
+          -struct arena* arena: Arena of the command.
+Returns: int: 0 if successful (with or without a prefix), -1 if a prefix
+              word has a bad value or is given to a shell builtin, after
+              printing an error.
+*/
+	struct placement* placement;
+	char** args = command->args;
+	const char* word;
+	const char* value;
+	size_t text_len = 0;
+	int num_words = 0;
+	int i;
+
+	if (args[0] == NULL)
+		return 0;
+
+	placement = arena_alloc(arena, sizeof(struct placement));
+	placement->pinned = 0;
+	placement->niceness = 0;
+	placement->policy = -1;
+	placement->ioprio = -1;
+
+	// Every prefix word takes one value, and there must be a command after.
+	while (args[num_words] != NULL && args[num_words + 1] != NULL && args[num_words + 2] != NULL)
+	{
+		word = args[num_words];
+		value = args[num_words + 1];
+
+		if (strcmp(word, "pin") == 0)
+		{
+			if (parse_cpus(value, &placement->cpus) == -1)
+			{
+				printf("pin: %s: invalid CPU list\n", value);
+				fflush(stdout);
+				return -1;
+			}
+			placement->pinned = 1;
+		}
+
+		else if (strcmp(word, "nice") == 0 && is_number(value))
+			placement->niceness = atoi(value);
+
+		else if (strcmp(word, "sched") == 0 && strcmp(value, "batch") == 0)
+			placement->policy = SCHED_BATCH;
+
+		else if (strcmp(word, "sched") == 0 && strcmp(value, "idle") == 0)
+			placement->policy = SCHED_IDLE;
+
+		else if (strcmp(word, "ionice") == 0 && strcmp(value, "idle") == 0)
+			placement->ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+
+		else if (strcmp(word, "ionice") == 0 && is_number(value))
+		{
+			if (atoi(value) < 0 || atoi(value) > 7)
+			{
+				printf("ionice: %s: priority must be 0-7\n", value);
+				fflush(stdout);
+				return -1;
+			}
+			placement->ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | atoi(value);
+		}
+
+		else
+			break;
+
+		text_len += strlen(word) + strlen(value) + 2;
+		num_words += 2;
+	}
+
+	if (num_words == 0)
+		return 0;
+
+	// A builtin that runs in the shell itself can't have a placement.
+	// Utilities such as echo run as programs when they have one.
+	if (find_shell_builtin(args[num_words], command->next_stage != NULL) != NULL)
+	{
+		printf("%s: %s: a shell builtin can't have a placement\n", args[0], args[num_words]);
+		fflush(stdout);
+		return -1;
+	}
+
+	// Keep the words for jobs, then shift the command to the front.
+	placement->text = arena_alloc(arena, text_len);
+	placement->text[0] = '\0';
+	for (i = 0; i < num_words; i++)
+	{
+		if (i > 0)
+			strcat(placement->text, " ");
+		strcat(placement->text, args[i]);
+	}
+
+	for (i = 0; args[i + num_words] != NULL; i++)
+		args[i] = args[i + num_words];
+	args[i] = NULL;
+
+	command->placement = placement;
+	return 0;
+}
+
+int apply_placement(const struct placement* placement){
+/*
+Applies a placement to the calling process. Called in the child between
+fork and exec.
+
+Receives: const struct placement* placement: The placement.
+Returns: int: 0 if successful, -1 if a setting failed, with errno set and
+              the name of the setting printed with perror().
+*/
+	struct sched_param param = {0};
+
+	if (placement->pinned && sched_setaffinity(0, sizeof(cpu_set_t), &placement->cpus) == -1)
+	{
+		perror("pin");
+		return -1;
+	}
+
+	// nice() can return -1 on success, so errno tells if it failed.
+	errno = 0;
+	if (placement->niceness != 0 && nice(placement->niceness) == -1 && errno != 0)
+	{
+		perror("nice");
+		return -1;
+	}
+
+	if (placement->policy != -1 && sched_setscheduler(0, placement->policy, &param) == -1)
+	{
+		perror("sched");
+		return -1;
+	}
+
+	if (placement->ioprio != -1
+		&& syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, placement->ioprio) == -1)
+	{
+		perror("ionice");
+		return -1;
+	}
+
+	return 0;
+}
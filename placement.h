@@ -0,0 +1,25 @@
+#ifndef __PLACEMENT_H__
+#define __PLACEMENT_H__
+
+// cpu_set_t needs _GNU_SOURCE, defined at the top of the files that
+// include this header.
+#include <sched.h>
+#include "command_info.h"
+#include "arena.h"
+
+// CPU and priority placement of a job, given with prefix words before the
+// command: pin CPUS, nice N, sched batch|idle, ionice N|idle. Applied in
+// each child of the job before exec.
+struct placement {
+	int pinned;      // 1 if cpus is set
+	cpu_set_t cpus;  // CPUs the job may run on
+	int niceness;    // added to the shell's nice value, 0 for no change
+	int policy;      // SCHED_BATCH or SCHED_IDLE, -1 for no change
+	int ioprio;      // I/O priority for ioprio_set(), -1 for no change
+	char* text;      // the prefix words, shown by jobs
+};
+
+int parse_placement(struct command_info* command, struct arena* arena);
+int apply_placement(const struct placement* placement);
+
+#endif // __PLACEMENT_H__
@@ -0,0 +1,185 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "proc_subst.h"
+#include "command_info.h"
+#include "job_table.h"
+#include "event_loop.h"
+#include "spawn_engine.h"
+#include "input_funcs.h"
+#include "arena.h"
+
+static int start_subst(struct proc_subst* subst, int background, struct job_table* jobs,
+	struct arena* arena){
+/*
+Runs the command of one process substitution. For <(command) the command's
+stdout is the write end of a pipe and the shell keeps the read end, for
+>(command) the other way around. The command's end is passed to it as a
+/dev/fd/N redirection, which the child opens before exec. The command is
+added to the job table as a quiet job, so the event loop cleans it up
+without reporting it.
+
+The command runs in the foreground or background like the command it is
+part of: in the foreground it shares the terminal and gets SIGINT, in the
+background it uses /dev/null and its own process group.
+
+Receives: -struct proc_subst* subst: The substitution.
+          -int background: 1 if the outer command runs in the background.
+          -struct job_table* jobs: The job table.
+          -struct arena* arena: Arena of the command.
+Returns: int: 0 if successful, -1 if the command could not be started,
+              after printing an error.
+*/
+	struct command_info* inner;
+	struct command_info* last;
+	struct job* job;
+	char job_line[256];
+	char* inner_path;
+	int pipe_fds[2];
+	int inner_fd;
+	int num_stages;
+	int num_procs = 0;
+	int i;
+
+	inner = arena_alloc(arena, sizeof(struct command_info));
+	if (tokenize(subst->command, inner, arena) == -1)
+		return -1;
+	if (inner->next_command != NULL)
+	{
+		printf("process substitution: only a pipeline is supported\n");
+		fflush(stdout);
+		return -1;
+	}
+
+	// Substitutions inside the command run first.
+	if (start_substs(inner, background, jobs, arena) == -1)
+		return -1;
+
+	if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+	{
+		perror("pipe");
+		fflush(stdout);
+		end_substs(inner);
+		return -1;
+	}
+	subst->fd = pipe_fds[subst->output ? 1 : 0];
+	inner_fd = pipe_fds[subst->output ? 0 : 1];
+
+	// An explicit redirection of the command wins over the pipe.
+	inner_path = arena_alloc(arena, SUBST_PATH_SIZE);
+	snprintf(inner_path, SUBST_PATH_SIZE, "/dev/fd/%d", inner_fd);
+	for (last = inner; last->next_stage != NULL; last = last->next_stage)
+		continue;
+	if (subst->output && inner->stdin_file == NULL && inner->stdin_data == NULL)
+		inner->stdin_file = inner_path;
+	else if (!subst->output && last->stdout_file == NULL)
+		last->stdout_file = inner_path;
+
+	pid_t pids[count_stages(inner)];
+	num_stages = spawn_pipeline(inner, background, pids);
+	close(inner_fd);
+	end_substs(inner);
+
+	for (i = 0; i < num_stages; i++)
+	{
+		if (pids[i] > 0)
+			pids[num_procs++] = pids[i];
+	}
+	if (num_procs == 0)
+	{
+		close(subst->fd);
+		subst->fd = -1;
+		return -1;
+	}
+
+	command_line(inner, job_line, sizeof(job_line));
+	job = add_job(jobs, pids, num_procs, job_line);
+	job->quiet = QUIET_REMOVE;
+	for (i = 0; i < num_procs; i++)
+		watch_bg(job, i);
+
+	snprintf(subst->path, SUBST_PATH_SIZE, "/dev/fd/%d", subst->fd);
+	return 0;
+}
+
+int start_substs(struct command_info* command, int background, struct job_table* jobs,
+	struct arena* arena){
+/*
+Runs the process substitutions of every command of a pipeline, before the
+pipeline itself is started. The shell's ends of the pipes stay
+close-on-exec, so the substitutions and the other stages don't hold each
+other's pipes open. Only the stage that names one inherits it, see
+inherit_substs().
+
+Receives: -struct command_info* command: First command of the pipeline.
+          -int background: 1 if the pipeline runs in the background.
+          -struct job_table* jobs: The job table.
+          -struct arena* arena: Arena of the command.
+Returns: int: 0 if successful, -1 if a substitution could not be started,
+              in which case the ones already running are closed.
+*/
+	struct command_info* stage;
+	struct proc_subst* subst;
+
+	for (stage = command; stage != NULL; stage = stage->next_stage)
+	{
+		for (subst = stage->subst; subst != NULL; subst = subst->next)
+		{
+			if (start_subst(subst, background, jobs, arena) == -1)
+			{
+				end_substs(command);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+void inherit_substs(struct command_info* stage, int inherit){
+/*
+Makes the shell's ends of the process substitution pipes of one pipeline
+stage inheritable while that stage is started, and close-on-exec again
+afterwards. The other stages don't get them, so a substitution sees EOF as
+soon as the stage that names it is done with it.
+
+Receives: -struct command_info* stage: The stage.
+          -int inherit: 1 before the stage is started, 0 after.
+Returns: Nothing
+*/
+	struct proc_subst* subst;
+
+	for (subst = stage->subst; subst != NULL; subst = subst->next)
+	{
+		if (subst->fd != -1)
+			fcntl(subst->fd, F_SETFD, inherit ? 0 : FD_CLOEXEC);
+	}
+}
+
+void end_substs(struct command_info* command){
+/*
+Closes the shell's ends of the process substitution pipes of a pipeline,
+once the pipeline has been started (or has run, for an in-process
+builtin). The substitution jobs keep running until they are done.
+
+Receives: struct command_info* command: First command of the pipeline.
+Returns: Nothing
+*/
+	struct command_info* stage;
+	struct proc_subst* subst;
+
+	for (stage = command; stage != NULL; stage = stage->next_stage)
+	{
+		for (subst = stage->subst; subst != NULL; subst = subst->next)
+		{
+			if (subst->fd != -1)
+				close(subst->fd);
+			subst->fd = -1;
+		}
+	}
+}
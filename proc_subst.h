@@ -0,0 +1,28 @@
+#ifndef __PROC_SUBST_H__
+#define __PROC_SUBST_H__
+
+#include "command_info.h"
+#include "job_table.h"
+#include "arena.h"
+
+// A process substitution in a command, <(command) or >(command). The
+// command runs as a quiet background job connected to the shell by a pipe,
+// and the word is replaced by /dev/fd/N, the shell's end of the pipe, which
+// stage of the outer command that names it inherits.
+struct proc_subst {
+	char* command;           // the inner command line
+	int output;              // 0 for <(command), 1 for >(command)
+	char* path;              // the word, /dev/fd/N once the command runs
+	int fd;                  // the shell's end of the pipe, -1 if not open
+	struct proc_subst* next; // next substitution of the same command
+};
+
+// Longest /dev/fd/N path.
+#define SUBST_PATH_SIZE 24
+
+int start_substs(struct command_info* command, int background, struct job_table* jobs,
+	struct arena* arena);
+void inherit_substs(struct command_info* stage, int inherit);
+void end_substs(struct command_info* command);
+
+#endif // __PROC_SUBST_H__
@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+// The line is scanned in blocks of 64 bytes, one bitmap word each. A block
+// function sets a bit in special for every blank, operator, quote and
+// backslash, and in dollar for every "$". The first "$" of a pair can only
+// be told once the next block is known, so scan_line() combines them.
+typedef void (*scan_block_fn)(const char* block, uint64_t* special, uint64_t* dollar);
+
+// Block function of the selected engine, NULL for the byte engine, which
+// marks every byte (the lexer's old per-byte path, kept for comparison).
+static scan_block_fn scan_block = NULL;
+static int selected = 0;
+
+// 1 for the chars that go in special.
+static const unsigned char special_chars[256] = {
+	[' '] = 1, ['\t'] = 1, ['|'] = 1, ['<'] = 1, ['>'] = 1, ['&'] = 1, [';'] = 1,
+	['\''] = 1, ['"'] = 1, ['\\'] = 1
+};
+
+static void scalar_bytes(const char* block, size_t length, uint64_t* special, uint64_t* dollar){
+/*
+Scans up to 64 bytes with a table lookup per byte. Used for the last,
+partial block of every line, and for whole blocks without SIMD.
+
+Receives: -const char* block: First byte of the block.
+          -size_t length: Number of bytes, at most 64.
+          -uint64_t* special: Set to the blanks, operators, quotes and
+           backslashes.
+          -uint64_t* dollar: Set to the "$" chars.
+Returns: Nothing
+*/
+	const unsigned char* bytes = (const unsigned char*) block;
+	uint64_t s = 0;
+	uint64_t d = 0;
+	size_t i;
+
+	for (i = 0; i < length; i++)
+	{
+		s |= (uint64_t) special_chars[bytes[i]] << i;
+		d |= (uint64_t) (bytes[i] == '$') << i;
+	}
+
+	*special = s;
+	*dollar = d;
+}
+
+static void scalar_block(const char* block, uint64_t* special, uint64_t* dollar){
+	scalar_bytes(block, 64, special, dollar);
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+static void sse2_block(const char* block, uint64_t* special, uint64_t* dollar){
+/*
+Scans 64 bytes as four 16-byte vectors, comparing each with every special
+char and collecting the results with movemask.
+
+Receives: -const char* block: First byte of the block.
+          -uint64_t* special: Set to the blanks, operators, quotes and
+           backslashes.
+          -uint64_t* dollar: Set to the "$" chars.
+Returns: Nothing
+*/
+	uint64_t s = 0;
+	uint64_t d = 0;
+	__m128i v;
+	__m128i m;
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		v = _mm_loadu_si128((const __m128i*) (block + i * 16));
+		m = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('|')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('<')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('>')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('&')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(';')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+		s |= (uint64_t) (uint16_t) _mm_movemask_epi8(m) << (i * 16);
+		d |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('$'))) << (i * 16);
+	}
+
+	*special = s;
+	*dollar = d;
+}
+
+__attribute__((target("avx2")))
+static void avx2_block(const char* block, uint64_t* special, uint64_t* dollar){
+/*
+Scans 64 bytes as two 32-byte vectors, like sse2_block().
+
+Receives: -const char* block: First byte of the block.
+          -uint64_t* special: Set to the blanks, operators, quotes and
+           backslashes.
+          -uint64_t* dollar: Set to the "$" chars.
+Returns: Nothing
+*/
+	uint64_t s = 0;
+	uint64_t d = 0;
+	__m256i v;
+	__m256i m;
+	int i;
+
+	for (i = 0; i < 2; i++)
+	{
+		v = _mm256_loadu_si256((const __m256i*) (block + i * 32));
+		m = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('|')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('<')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('>')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('&')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(';')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\'')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"')));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\\')));
+		s |= (uint64_t) (uint32_t) _mm256_movemask_epi8(m) << (i * 32);
+		d |= (uint64_t) (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('$'))) << (i * 32);
+	}
+
+	*special = s;
+	*dollar = d;
+}
+
+#endif // SCAN_X86
+
+const char* select_scanner(const char* name){
+/*
+Selects the engine used by scan_line(): "avx2", "sse2", "scalar" or
+"byte". An engine the CPU does not support, an unknown name or NULL
+selects the fastest one that it supports. Set with SMALLSH_SCAN.
+
+Receives: const char* name: Name of the engine, or NULL.
+Returns: const char*: Name of the selected engine.
+*/
+	selected = 1;
+
+	if (name != NULL && strcmp(name, "byte") == 0)
+	{
+		scan_block = NULL;
+		return "byte";
+	}
+
+	if (name != NULL && strcmp(name, "scalar") == 0)
+	{
+		scan_block = scalar_block;
+		return "scalar";
+	}
+
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if ((name == NULL || strcmp(name, "sse2") != 0) && __builtin_cpu_supports("avx2"))
+	{
+		scan_block = avx2_block;
+		return "avx2";
+	}
+	if (__builtin_cpu_supports("sse2"))
+	{
+		scan_block = sse2_block;
+		return "sse2";
+	}
+#endif
+
+	scan_block = scalar_block;
+	return "scalar";
+}
+
+void scan_line(const char* line, size_t length, uint64_t* bits){
+/*
+Builds the bitmap of a line in one pass. Whole blocks of 64 bytes go
+through the selected engine and the rest through the scalar loop, so no
+byte after the null byte is read.
+
+Receives: -const char* line: The line.
+          -size_t length: Its length, without the null byte.
+          -uint64_t* bits: Filled with SCAN_WORDS(length) words.
+Returns: Nothing
+*/
+	size_t num_words = SCAN_WORDS(length);
+	size_t word;
+	uint64_t special;
+	uint64_t dollar;
+	uint64_t prev_special = 0;
+	uint64_t prev_dollar = 0;
+
+	if (!selected)
+		select_scanner(NULL);
+
+	if (scan_block == NULL)
+	{
+		memset(bits, 0xff, num_words * sizeof(uint64_t));
+		return;
+	}
+
+	for (word = 0; word < num_words; word++)
+	{
+		if ((word + 1) * 64 <= length)
+			scan_block(line + word * 64, &special, &dollar);
+		else
+		{
+			scalar_bytes(line + word * 64, length - word * 64, &special, &dollar);
+			special |= (uint64_t) 1 << (length % 64);
+		}
+
+		// A "$" is marked if the next char, maybe in this block, is too.
+		if (word > 0)
+			bits[word - 1] = prev_special | (prev_dollar & ((prev_dollar >> 1) | (dollar << 63)));
+		prev_special = special;
+		prev_dollar = dollar;
+	}
+
+	bits[num_words - 1] = prev_special | (prev_dollar & (prev_dollar >> 1));
+}
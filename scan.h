@@ -0,0 +1,38 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bitmap of the bytes of a line that the lexer has to look at one by one:
+// blanks, the operators | < > & ;, quotes, backslashes, the first "$" of
+// each "$$" and the null byte at the end. Bit i of word i / 64 is byte i.
+// Every other byte is copied as it is, in whatever state the lexer is in,
+// so tokenize() copies each run of them at once.
+
+// Number of bitmap words for a line of length chars, including its null
+// byte.
+#define SCAN_WORDS(length) ((length) / 64 + 1)
+
+const char* select_scanner(const char* name);
+void scan_line(const char* line, size_t length, uint64_t* bits);
+
+static inline size_t scan_next(const uint64_t* bits, size_t pos){
+/*
+Finds the next marked byte at or after pos. The null byte is always
+marked, so there is one.
+
+Receives: -const uint64_t* bits: Bitmap from scan_line().
+          -size_t pos: Index to start at.
+Returns: size_t: Index of the marked byte.
+*/
+	size_t word = pos / 64;
+	uint64_t mask = bits[word] & (~(uint64_t) 0 << (pos % 64));
+
+	while (mask == 0)
+		mask = bits[++word];
+
+	return word * 64 + __builtin_ctzll(mask);
+}
+
+#endif // __SCAN_H__
@@ -0,0 +1,131 @@
+#include <string.h>
+#include <stdint.h>
+#include "sha256.h"
+
+static const uint32_t k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void compress(uint32_t* state, const unsigned char* block){
+/*
+Runs the compression function on one 64-byte block.
+
+Receives: -uint32_t* state: The hash state, updated.
+          -const unsigned char* block: The block.
+Returns: Nothing
+*/
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h;
+	uint32_t t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t) block[i * 4] << 24 | (uint32_t) block[i * 4 + 1] << 16
+			| (uint32_t) block[i * 4 + 2] << 8 | block[i * 4 + 3];
+	for (i = 16; i < 64; i++)
+		w[i] = w[i - 16] + (ROTR(w[i - 15], 7) ^ ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3))
+			+ w[i - 7] + (ROTR(w[i - 2], 17) ^ ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+	for (i = 0; i < 64; i++)
+	{
+		t1 = h + (ROTR(e, 6) ^ ROTR(e, 11) ^ ROTR(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+		t2 = (ROTR(a, 2) ^ ROTR(a, 13) ^ ROTR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+void sha256_init(struct sha256* sha){
+/*
+Starts a digest.
+
+Receives: struct sha256* sha: The digest.
+Returns: Nothing
+*/
+	static const uint32_t initial[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(sha->state, initial, sizeof(initial));
+	sha->length = 0;
+}
+
+void sha256_update(struct sha256* sha, const void* data, size_t size){
+/*
+Adds bytes to a digest. Whole blocks are compressed straight from data.
+
+Receives: -struct sha256* sha: The digest.
+          -const void* data: The bytes.
+          -size_t size: Number of bytes.
+Returns: Nothing
+*/
+	const unsigned char* bytes = data;
+	size_t used = sha->length % 64;
+	size_t count;
+
+	sha->length += size;
+
+	if (used > 0)
+	{
+		count = (size < 64 - used) ? size : 64 - used;
+		memcpy(sha->block + used, bytes, count);
+		bytes += count;
+		size -= count;
+		if (used + count < 64)
+			return;
+		compress(sha->state, sha->block);
+	}
+
+	for (; size >= 64; bytes += 64, size -= 64)
+		compress(sha->state, bytes);
+	memcpy(sha->block, bytes, size);
+}
+
+void sha256_final(struct sha256* sha, unsigned char digest[32]){
+/*
+Finishes a digest: pads the last block with a 1 bit, zeros and the length
+in bits.
+
+Receives: -struct sha256* sha: The digest.
+          -unsigned char digest[32]: Filled with the digest.
+Returns: Nothing
+*/
+	uint64_t bits = sha->length * 8;
+	size_t used = sha->length % 64;
+	int i;
+
+	sha->block[used++] = 0x80;
+	if (used > 56)
+	{
+		memset(sha->block + used, 0, 64 - used);
+		compress(sha->state, sha->block);
+		used = 0;
+	}
+	memset(sha->block + used, 0, 56 - used);
+	for (i = 0; i < 8; i++)
+		sha->block[56 + i] = bits >> (56 - i * 8);
+	compress(sha->state, sha->block);
+
+	for (i = 0; i < 8; i++)
+	{
+		digest[i * 4] = sha->state[i] >> 24;
+		digest[i * 4 + 1] = sha->state[i] >> 16;
+		digest[i * 4 + 2] = sha->state[i] >> 8;
+		digest[i * 4 + 3] = sha->state[i];
+	}
+}
@@ -0,0 +1,18 @@
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SHA-256 (FIPS 180-4), fed in any number of pieces.
+struct sha256 {
+	uint32_t state[8];
+	uint64_t length;         // bytes added so far
+	unsigned char block[64]; // bytes of the block being filled
+};
+
+void sha256_init(struct sha256* sha);
+void sha256_update(struct sha256* sha, const void* data, size_t size);
+void sha256_final(struct sha256* sha, unsigned char digest[32]);
+
+#endif // __SHA256_H__
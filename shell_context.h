@@ -0,0 +1,31 @@
+#ifndef __SHELL_CONTEXT_H__
+#define __SHELL_CONTEXT_H__
+
+#include <signal.h>
+#include "smallsh.h"
+#include "command_info.h"
+#include "job_table.h"
+#include "arena.h"
+
+// State of a shell between commands. The interactive shell has one, and
+// libsmallsh hands one out with smallsh_open().
+struct smallsh {
+	struct job_table jobs;              // background and spawned jobs
+	int last_status;                    // status of the last foreground command
+	volatile sig_atomic_t fg_only_mode; // if 1, & is ignored. Toggled by the
+	                                    // SIGTSTP handler in the interactive shell.
+};
+
+// A command list parsed by smallsh_parse(), with the arena it lives in.
+// What a run allocates, such as the commands of process substitutions,
+// goes in run_arena, which is reset at the start of every run.
+struct smallsh_command {
+	struct arena arena;
+	struct arena run_arena;
+	struct command_info info;
+};
+
+int init_smallsh(struct smallsh* shell, int watch_stdin);
+int run_list(struct smallsh* shell, struct command_info* command, struct arena* arena, int exit_on_error);
+
+#endif // __SHELL_CONTEXT_H__
@@ -1,19 +1,40 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
 #include "shell_process.h"
 #include "command_info.h"
-#include "list_node.h"
-
-// Defined in main.c. Used by sigtstp_handler function to toggle between
-// foreground_only and regular modes.
-extern int fg_only_mode;
+#include "job_table.h"
+#include "event_loop.h"
+#include "spawn_engine.h"
+#include "input_funcs.h"
+#include "path_cache.h"
+#include "stats.h"
+#include "trace.h"
+#include "proc_subst.h"
+
+// fg_only_mode of the shell's context, set by make_sigtstp_struct(). Used
+// by sigtstp_handler function to toggle between foreground_only and
+// regular modes.
+static volatile sig_atomic_t* fg_only_mode = NULL;
+
+// How long background jobs have to exit after SIGTERM when the shell exits,
+// unless exit --timeout is given.
+#define EXIT_TIMEOUT_MS 5000
+
+// Resources used by the most recent foreground job. Filled in by wait_fg()
+// and printed by the time prefix and status -v.
+static struct fg_usage last_usage;
 
 void sigtstp_handler(int signo){
 /*
@@ -21,10 +42,12 @@ Executes if a SIGTSTP signal is received by the parent process.
 Toggles the fg_only_mode on or off depending on its current state and
 writes a message to STDOUT.
 */
+	(void) signo;
+
 	// If fg_only_mode is on, turn it off
-	if (fg_only_mode)
+	if (*fg_only_mode)
 	{
-		fg_only_mode = 0;
+		*fg_only_mode = 0;
 		char* message = "\nExiting foreground-only mode\n";
 		write(STDOUT_FILENO, message, 31);
 		fflush(stdout);
@@ -33,23 +56,26 @@ writes a message to STDOUT.
 	// If fg_only_mode is off, turn it on
 	else
 	{
-		fg_only_mode = 1;
+		*fg_only_mode = 1;
 		char* message = "\nEntering foreground-only mode (& is now ignored)\n";
 		write(STDOUT_FILENO, message, 51);
 		fflush(stdout);
 	}
 }
 
-void make_sigtstp_struct(struct sigaction * sig){
+void make_sigtstp_struct(struct sigaction * sig, volatile sig_atomic_t* mode){
 /*
 Short function that creates a sigaction struct for the parent process,
 called at the beginning of main.c
 
-Receives: struct sigaction* sig: Pointer to struct that will be filled.
+Receives: -struct sigaction* sig: Pointer to struct that will be filled.
+          -volatile sig_atomic_t* mode: fg_only_mode of the shell's
+           context, which the handler toggles.
 Returns: Nothing, just fills the struct.
 */
 	// When SIGTSTP signal received in parent process, the sigtstp_handler
 	// function, defined in this file, will execute.
+	fg_only_mode = mode;
 	sig->sa_handler = sigtstp_handler;
 	sigfillset(&sig->sa_mask);
 	sig->sa_flags = 0;
@@ -70,119 +96,106 @@ Returns: Nothing, just fills the struct.
 	sig->sa_flags = 0;
 }
 
-void cleanup_bg(struct pid_node* list, struct pid_node** head, struct pid_node** tail){
+static void report_bg(struct job_table* jobs, struct job* job){
 /*
-Searches through a linked list of process IDs, searching for any IDs representing
-child processes that have not been cleaned up. If found, it cleans up the terminated
-process and removes its corresponding node from the linked list.
-
-Receives: -struct pid_node* list: The head of the linked list.
-          -struct pid_node** head: This is a pointer to the head pointer in the main
-		                           function. When dereferencing this double pointer,
-								   we can change the value of the head pointer that
-								   resides in main.
-
-          -struct pid_node** tail: This is a pointer to the tail pointer in the main
-		                           function. When dereferencing this double pointer,
-								   we can change the value of the tail pointer that
-								   resides in main.
-
+Reports a background job whose processes have all been cleaned up, printing
+the exit value of its last process or the signal that terminated it, and
+removes it from the job table. Quiet jobs are not reported. QUIET_KEEP jobs
+are only marked as done, and are reported and removed by the builtin that
+started them.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct job* job: The job that terminated.
 Returns: Nothing.
 */
-	struct pid_node* prev = NULL;
-	int wstatus;
-	int remove_flag = 0;
-	pid_t childPID;
+	if (job->quiet == QUIET_KEEP)
+	{
+		job->state = JOB_DONE;
+		return;
+	}
+	if (job->quiet == QUIET_REMOVE)
+	{
+		remove_job(jobs, job);
+		return;
+	}
 
-	// Iterate through linked list
-	while (list != NULL)
+	// If exited normally, print exit status, otherwise print signal that caused termination.
+	if (WIFEXITED(job->wstatus))
 	{
-		// If childPID isn't 0, there was a child that terminated.
-		if (childPID = waitpid(list->pid, &wstatus, WNOHANG))
-		{
-			// Flag to be used below, indicates a node is being removed from the linked list.
-			remove_flag = 1;
+		printf("background pid %d is done: exit value %d\n", job->pid, WEXITSTATUS(job->wstatus));
+		fflush(stdout);
+	}
+	
+	else
+	{
+		printf("background pid %d is done: terminated by signal %d\n", job->pid, WTERMSIG(job->wstatus));
+		fflush(stdout);
+	}
 
-			// If exited normally, print exit status, otherwise print signal that caused termination.
-			if (WIFEXITED(wstatus))
-			{
-				printf("background pid %d is done: exit value %d\n", childPID, WEXITSTATUS(wstatus));
-				fflush(stdout);
-			}
-			
-			else
-			{
-				printf("background pid %d is done: terminated by signal %d\n", childPID, WTERMSIG(wstatus));
-				fflush(stdout);
-			}
+	remove_job(jobs, job);
+}
 
+int bg_proc_done(struct job_table* jobs, struct job* job, int proc, int wstatus){
+/*
+Records that one process of a background job has been cleaned up. Once all
+of the job's processes are done, the job is reported and removed.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct job* job: The job the process belongs to.
+          -int proc: Index of the process in job->procs.
+          -int wstatus: Its status from waitpid().
+Returns: int: 1 if the whole job was reported, 0 otherwise.
+*/
+	// The status of a pipeline is the status of its last command.
+	if (proc == job->num_procs - 1)
+		job->wstatus = wstatus;
+	trace_exit(job->procs[proc].pid, wstatus);
 
-		// Since a process exited and we cleaned it up, we now must remove the linked list node
-		// associated with that process. The if statements below determine which node needs to be
-		// removed and remove it. Note, if the node is at the head or tail, it must be removed
-		// differently from a node in the middle of the list. The head and tail variables are
-		// double pointers received as input to the function. When dereferenced they allow us
-		// to change the head and tail variables defined in the main function.
+	// Close the process's pidfd, which also removes it from the event loop.
+	unwatch_bg(job, proc);
+	job_proc_done(jobs, job, proc);
 
-			// If the node to be removed is the only one in the list:
-			if (list == *head && list == *tail)
-			{
-				// Free node and change head and tail pointers to NULL.
-				free(list);
-				*head = NULL;
-				*tail = NULL;
-
-				// Exit from function as there are was only one node in the list, don't have
-				// to check for more
-				return;
-			}
+	if (job->live_procs > 0)
+		return 0;
 
-			// Multiple items in the list. Just have to remove head.
-			else if (list == *head && list != *tail)
-			{
-				*head = (*head)->next;	
-				free(list);
-			}
+	report_bg(jobs, job);
+	return 1;
+}
 
-			// Multiple items in the list. Just have to remove tail.
-			else if (list != *head && list == *tail)
-			{
-				*tail = prev;
-				(*tail)->next = NULL;
-				free(list);
-			}
+int reap_bg(struct job_table* jobs, struct job* job, int proc){
+/*
+Checks if a process of a background job has terminated. If so, cleans it
+up, and reports and removes the job once all its processes are done.
+Called by the event loop when the process's pidfd becomes readable, so it
+never has to search for the job.
 
-			// Current node to remove is neither head nor tail.
-			else
-			{
-				prev->next = list->next;
-				free(list);
-			}
-		}
+Receives: -struct job_table* jobs: The job table.
+          -struct job* job: The job to check.
+          -int proc: Index of the process in job->procs.
 
-		// This flag is set above if a process is terminated. It lets us know
-		// a node was removed from the linked list. If so, simply re-start iteration
-		// through the list starting at the head of the list (which may have changed
-		// if the head was the node that was removed).
-		if (remove_flag == 1)
-		{
-			list = *head;
-			prev = NULL;
-			remove_flag = 0;
-		}
+Returns: int: 1 if the whole job was reported, 0 otherwise.
+*/
+	int wstatus;
+	int reported;
+	pid_t childPID;
 
-		// No nodes were removed, so simply iterate to the next node in the list.
-		else
-		{
-			prev = list;
-			list = list->next;
-		}
-	}
+	STAT_START(reap_start);
+
+	// If childPID is 0, the process is still running. A result of -1 means
+	// the process was already cleaned up elsewhere, which is treated as a
+	// normal exit.
+	childPID = waitpid(job->procs[proc].pid, &wstatus, WNOHANG);
+	if (childPID == 0)
+		return 0;
+	if (childPID == -1)
+		wstatus = 0;
 
-	return;
+	reported = bg_proc_done(jobs, job, proc, wstatus);
+	STAT_END(STAT_REAP, reap_start);
+	return reported;
 }
 
-void change_dir(struct command_info* command){
+int change_dir(struct command_info* command){
 /*
 Changes the working directory of the current process. Note, this does not
 update the env variable PWD.
@@ -191,7 +204,8 @@ Receives: -struct command_info* command: Pointer to a struct that holds
            command info. Only uses the arg at index 1 of the args array,
 		   regardless of how many args are in the struct.
 
-Returns: Nothing
+Returns: int: Termination status for the status builtin, exit value 1 if
+              the directory could not be changed.
 */
 	int result;
 	char* home_dir;
@@ -215,47 +229,317 @@ Returns: Nothing
 	{
 		printf("Error opening directory\n");
 		fflush(stdout);
+		return W_EXITCODE(1, 0);
 	}
+
+	return 0;
 }
 
-void exit_shell(struct pid_node* list){
+static int signal_job(struct job* job, int signo){
+/*
+Sends a signal to a job. Background jobs have their own process group. The
+jobs of a foreground process substitution stay in the shell's group, so
+their processes are signaled one by one.
+
+Receives: -struct job* job: The job.
+          -int signo: The signal.
+Returns: int: 0 if any process was signaled, -1 otherwise, with errno set.
+*/
+	int result = -1;
+	int i;
+
+	if (kill(-job->pid, signo) == 0)
+		return 0;
+
+	for (i = 0; i < job->num_procs; i++)
+	{
+		if (job->procs[i].pid != 0 && kill(job->procs[i].pid, signo) == 0)
+			result = 0;
+	}
+
+	return result;
+}
+
+static void update_stopped(struct job* job){
+/*
+Reads whether a job is stopped or running from its first live process,
+without consuming the state change. This catches a job stopped or
+continued from outside the shell, which its pidfds do not report.
+
+Receives: struct job* job: The job.
+Returns: Nothing
+*/
+	siginfo_t info;
+	int i;
+
+	for (i = 0; i < job->num_procs && job->procs[i].pid == 0; i++)
+		;
+	if (i == job->num_procs)
+		return;
+
+	info.si_pid = 0;
+	if (waitid(P_PID, job->procs[i].pid, &info, WSTOPPED | WCONTINUED | WNOHANG | WNOWAIT) == -1
+		|| info.si_pid == 0)
+		return;
+
+	if (info.si_code == CLD_STOPPED || info.si_code == CLD_TRAPPED)
+		job->state = JOB_STOPPED;
+	else if (info.si_code == CLD_CONTINUED)
+		job->state = JOB_RUNNING;
+}
+
+static int reap_stopping(struct job_table* jobs){
+/*
+Cleans up every process of the jobs being stopped by exit_shell() that has
+terminated, without blocking. A job whose processes are all done is marked
+JOB_DONE, with the status of its last process in job->wstatus.
+
+Receives: struct job_table* jobs: The job table.
+Returns: int: Number of processes that are still running.
+*/
+	struct job* job;
+	int wstatus;
+	int live = 0;
+	int i;
+	int proc;
+
+	for (i = 0; i < jobs->capacity; i++)
+	{
+		job = &jobs->jobs[i];
+		if (job->state != JOB_RUNNING)
+			continue;
+
+		for (proc = 0; proc < job->num_procs; proc++)
+		{
+			if (job->procs[proc].pid == 0)
+				continue;
+
+			// -1 means the process was already cleaned up elsewhere.
+			wstatus = 0;
+			if (waitpid(job->procs[proc].pid, &wstatus, WNOHANG) == 0)
+			{
+				live++;
+				continue;
+			}
+			if (proc == job->num_procs - 1)
+				job->wstatus = wstatus;
+			trace_exit(job->procs[proc].pid, wstatus);
+			unwatch_bg(job, proc);
+			job_proc_done(jobs, job, proc);
+		}
+
+		if (job->live_procs == 0)
+			job->state = JOB_DONE;
+	}
+
+	return live;
+}
+
+static int wait_stopping(struct job_table* jobs, int timeout_ms){
+/*
+Waits up to timeout_ms for the jobs being stopped to terminate. Sleeps in
+poll() on the pidfds of their processes, so no CPU is used while waiting.
+Processes without a pidfd are checked every 50ms instead.
+
+Receives: -struct job_table* jobs: The job table.
+          -int timeout_ms: How long to wait, in milliseconds.
+Returns: int: Number of processes that are still running.
+*/
+	struct pollfd* fds;
+	struct timespec deadline;
+	struct timespec now;
+	struct job* job;
+	long remaining;
+	int num_fds;
+	int unwatched;
+	int live;
+	int i;
+	int proc;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	while ((live = reap_stopping(jobs)) > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		remaining = (deadline.tv_sec - now.tv_sec) * 1000
+			+ (deadline.tv_nsec - now.tv_nsec) / 1000000;
+		if (remaining <= 0)
+			break;
+
+		// A pidfd becomes readable when its process terminates.
+		fds = malloc(sizeof(struct pollfd) * live);
+		num_fds = 0;
+		unwatched = 0;
+		for (i = 0; i < jobs->capacity; i++)
+		{
+			job = &jobs->jobs[i];
+			if (job->state != JOB_RUNNING)
+				continue;
+			for (proc = 0; proc < job->num_procs; proc++)
+			{
+				if (job->procs[proc].pid == 0)
+					continue;
+				if (job->procs[proc].pidfd == -1)
+				{
+					unwatched = 1;
+					continue;
+				}
+				fds[num_fds].fd = job->procs[proc].pidfd;
+				fds[num_fds].events = POLLIN;
+				num_fds++;
+			}
+		}
+
+		if (unwatched && remaining > 50)
+			remaining = 50;
+		poll(fds, num_fds, remaining);
+		free(fds);
+	}
+
+	return live;
+}
+
+void exit_shell(struct job_table* jobs, int exit_value){
 /*
 This function execute when the user enters the "exit" command.
 It terminates and cleans up all background child processes
-then terminates itself.
+then terminates itself. Uses the default timeout, see stop_jobs().
 
-Receives: struct pid_node* list: head of linked list containing
-          pids of running background processes.
+Receives: -struct job_table* jobs: table of running background jobs.
+          -int exit_value: Exit value of the shell.
 */
-	pid_t childPID;
-	int wstatus;
+	stop_jobs(jobs, EXIT_TIMEOUT_MS);
+	exit(exit_value);
+}
+
+void stop_jobs(struct job_table* jobs, int timeout_ms){
+/*
+Terminates every background job before the shell exits. Each job gets
+SIGTERM, and SIGKILL if it is still running after timeout_ms. Then prints
+how each job ended.
 
-	// Iterate through linked list
-	while (list != NULL)
+Receives: -struct job_table* jobs: table of running background jobs.
+          -int timeout_ms: How long jobs have to exit after SIGTERM.
+Returns: Nothing
+*/
+	struct job* job;
+	char* killed;
+	int stopping = 0;
+	int i;
+	int proc;
+
+	// Send the SIGTERM signal to the process group of every job in the
+	// table. Stopped jobs are continued so they can act on it. Jobs that
+	// are already done are not touched.
+	for (i = 0; i < jobs->capacity; i++)
 	{
-		// Send the SIGTERM signal with the node's pid, then
-		// go to the next node in the list.
-		kill(list->pid, SIGTERM);
-		list = list->next;
+		job = &jobs->jobs[i];
+		if (job->state == JOB_FREE || job->state == JOB_DONE)
+			continue;
+		update_stopped(job);
+		signal_job(job, SIGTERM);
+		if (job->state == JOB_STOPPED)
+			signal_job(job, SIGCONT);
+		job->state = JOB_RUNNING;
+		stopping++;
 	}
 
-	// At this point, all background children have received a 
-	// termination signal. Clean them all up with a WAITPID loop.
-	while ((childPID = waitpid(-1, &wstatus, WNOHANG)) != -1)
-		continue;
-	
-	// When waitpid returns -1, if the error type was ECHILD, we know
-	// there are no more children left to clean up, so we can
-	// exit normally. Any other error type means there was an error
-	// with waitpid.
-	if (errno == ECHILD)
-		exit(0);
-	else
+	if (stopping == 0)
+		return;
+
+	// Jobs still running at the deadline are killed, then waited for.
+	killed = calloc(jobs->capacity, 1);
+	if (wait_stopping(jobs, timeout_ms) > 0)
 	{
-		printf("Error during waitpid() in exit function\n");
-		fflush(stdout);
-		exit(1);
+		for (i = 0; i < jobs->capacity; i++)
+		{
+			job = &jobs->jobs[i];
+			if (job->state != JOB_RUNNING)
+				continue;
+			killed[i] = 1;
+			signal_job(job, SIGKILL);
+			for (proc = 0; proc < job->num_procs; proc++)
+			{
+				if (job->procs[proc].pid != 0)
+					waitpid(job->procs[proc].pid, NULL, 0);
+			}
+		}
+		reap_stopping(jobs);
+	}
+
+	// Summary of how each job ended. Quiet jobs belong to other builtins
+	// and are not listed.
+	for (i = 0; i < jobs->capacity; i++)
+	{
+		job = &jobs->jobs[i];
+		if (job->state != JOB_DONE || job->quiet)
+			continue;
+
+		printf("[%d] %d ", job->id, job->pid);
+		if (killed[i])
+			printf("killed after %d.%03ds", timeout_ms / 1000, timeout_ms % 1000);
+		else if (WIFSIGNALED(job->wstatus))
+			printf("terminated by signal %d", WTERMSIG(job->wstatus));
+		else
+			printf("exit value %d", WEXITSTATUS(job->wstatus));
+		printf(" %s\n", job->command);
 	}
+	fflush(stdout);
+	free(killed);
+}
+
+void exit_command(struct job_table* jobs, struct command_info* command){
+/*
+Built in "exit" command: exit [--timeout SECONDS] [N]. Exits the shell
+with value N (0 by default), giving background jobs SECONDS to exit after
+SIGTERM before they are killed.
+
+Receives: -struct job_table* jobs: table of running background jobs.
+          -struct command_info* command: The exit command.
+Returns: Nothing if successful. Returns after printing an error if the
+         timeout is not valid.
+*/
+	char** args = command->args + 1;
+	double timeout;
+	char* end;
+
+	if (args[0] != NULL && strcmp(args[0], "--timeout") == 0)
+	{
+		timeout = (args[1] != NULL) ? strtod(args[1], &end) : -1;
+		if (args[1] == NULL || *end != '\0' || end == args[1] || timeout < 0 || timeout > 86400)
+		{
+			printf("exit: --timeout needs a number of seconds\n");
+			fflush(stdout);
+			return;
+		}
+		stop_jobs(jobs, (int) (timeout * 1000));
+		exit(args[2] ? atoi(args[2]) : 0);
+	}
+
+	exit_shell(jobs, args[0] ? atoi(args[0]) : 0);
+}
+
+int exit_value(int wstatus){
+/*
+Converts the termination status of a process to the value a shell exits
+with: the process's exit value, or 128 plus the signal that terminated it.
+
+Receives: int wstatus: Status from waitpid(), or -1 if the process could
+                       not be started.
+Returns: int: The exit value.
+*/
+	if (wstatus == -1)
+		return 1;
+	if (WIFEXITED(wstatus))
+		return WEXITSTATUS(wstatus);
+	return 128 + WTERMSIG(wstatus);
 }
 
 void status(int fg_status){
@@ -281,286 +565,526 @@ Returns: Nothing
 	}
 }
 
-struct pid_node* add_node(pid_t processID){
+int status_command(int fg_status, struct command_info* command){
 /*
-Creates a linked list node.
+Built in "status" command. Prints the status of the most recently
+terminated fg process, and with -v also the resources it used.
 
-Receives: pid_t processID: Will be "pid" member of node
-Returns: Pointer to the newly created node.
+Receives: -int fg_status: The raw status of the last fg process.
+          -struct command_info* command: The status command.
+Returns: int: Termination status of the builtin itself, exit value 2 for
+              a usage error.
 */
-	// Dynamically allocate memory for the node.
-	struct pid_node* new_node = malloc(sizeof(struct pid_node));
-
-	// Set pid member to the input PID and the next pointer to NULL.
-	new_node->pid = processID;
-	new_node->next = NULL;
+	if (command->args[1] != NULL && (strcmp(command->args[1], "-v") != 0 || command->args[2] != NULL))
+	{
+		printf("usage: status [-v]\n");
+		fflush(stdout);
+		return W_EXITCODE(2, 0);
+	}
 
-	return new_node;
+	status(fg_status);
+	if (command->args[1] != NULL)
+		print_usage();
+	return 0;
 }
 
-pid_t bg_proc(struct command_info* command){
+void print_usage(void){
 /*
-Uses fork and exec to create a background process. Since this is
-a bg process, there is no waitpid to clean up the process. It is
-eventually cleaned up outside the function.
+Prints the resources used by the most recent foreground job: wall time,
+user and system CPU time, max RSS, page faults and context switches.
+Used by the time prefix and status -v.
 
-Receives: struct command_info* command: Pointer to struct with 
-          information for command (args, i/o redirection files).
-
-Returns: If succesful, returns pid of new bg process.
-         If failure, returns -1.
+Receives: Nothing
+Returns: Nothing
 */
+	struct rusage* usage = &last_usage.rusage;
+
+	printf("real %ld.%03lds user %ld.%03lds sys %ld.%03lds\n",
+		(long) last_usage.wall.tv_sec, last_usage.wall.tv_nsec / 1000000,
+		(long) usage->ru_utime.tv_sec, (long) usage->ru_utime.tv_usec / 1000,
+		(long) usage->ru_stime.tv_sec, (long) usage->ru_stime.tv_usec / 1000);
+	printf("maxrss %ldKB faults %ld major %ld minor ctxsw %ld voluntary %ld involuntary\n",
+		usage->ru_maxrss, usage->ru_majflt, usage->ru_minflt,
+		usage->ru_nvcsw, usage->ru_nivcsw);
+	fflush(stdout);
+}
 
-	// Background processes ignore the SIGTSTP signal. This differs from
-	// the parent process, which does not ignore SIGTSTP and has a handler
-	// for it.
-	struct sigaction sigtstp_action = {0};
+pid_t bg_proc(struct command_info* command, struct job_table* jobs){
+/*
+Uses the spawn engine to create a background process, or one process per
+command of a pipeline, and adds them to the job table as one job. Since
+this is a bg job, there is no waitpid to clean up the processes. They are
+cleaned up by the event loop.
 
-	int infile;
-	int outfile;
-	int dup_result;
-	int exec_result;
-	char devnull[] = "/dev/null";
-	pid_t childPID;
+Receives: -struct command_info* command: Pointer to struct with 
+           information for command (args, i/o redirection files).
+          -struct job_table* jobs: The job table.
 
-// Create child process
-	switch (childPID = fork())
+Returns: If succesful, returns pid of the first process of the new job.
+         If failure, returns -1.
+*/
+	char job_command[256];
+	struct job* job;
+	pid_t pids[count_stages(command)];
+	int num_stages;
+	int num_procs = 0;
+	int i;
+
+	// Create the children. Background processes ignore SIGINT and SIGTSTP,
+	// and read/write /dev/null unless redirected or piped.
+	num_stages = spawn_pipeline(command, 1, pids);
+
+	// Keep the processes that were started. If none were, either no process
+	// could be created or they all failed before exec.
+	for (i = 0; i < num_stages; i++)
 	{
+		if (pids[i] > 0)
+			pids[num_procs++] = pids[i];
+	}
+	if (num_procs == 0)
+		return -1;
+
+	// Add the new job to the job table, described by its command line, and
+	// watch it so its termination is reported as soon as it happens.
+	command_line(command, job_command, sizeof(job_command));
+	job = add_job(jobs, pids, num_procs, job_command);
+	for (i = 0; i < num_procs; i++)
+		watch_bg(job, i);
+
+	// Since this is a background process, do not wait for the child.
+	printf("Background pid is %d\n", pids[0]);	
+	fflush(stdout);
+	return pids[0];	
+}
 
-// Handle fork error
-		case -1:
-			printf("Error during fork\n");
-			fflush(stdout);
-			return -1;
-
-// Child process
-		case 0:
-	// Ignore SIGTSTP. This must be done in the bg process because
-	// the parent process does not ignore SIGTSTP
-			sigtstp_action.sa_handler = SIG_IGN;
-			sigfillset(&sigtstp_action.sa_mask);
-			sigtstp_action.sa_flags = 0;
-			sigaction(SIGTSTP, &sigtstp_action, NULL);
-	
-	// stdin redirection
-			// If user redirected input, open the stdin_file, otherwise
-			// open /dev/null.
-			if (command->stdin_file != NULL)
-				infile = open(command->stdin_file, O_RDONLY);
-			else
-				infile = open(devnull, O_RDONLY);
-
-			// if there was an error opening either file exit failure.
-			if (infile == -1)
-			{
-				exit(1);
-			}
+int fg_spawn_failed(void){
+/*
+Checks if a process of the most recent foreground job could not be
+started, because no process could be created or a redirection or the exec
+failed before the program ran. Used by the cache prefix, which does not
+store such a result.
 
-			// Redirect the stdin_file descriptor to point to the file
-			// we just opened.
-			dup_result = dup2(infile, 0);
+Receives: Nothing
+Returns: int: 1 if one failed, 0 otherwise.
+*/
+	return last_usage.spawn_failed;
+}
 
-			// If there was an error during dup2 exit failure.
-			if (dup_result == -1)
-			{
-				exit(1);
-			}
+int wait_fg(pid_t* pids, int num_procs, const struct timespec* start){
+/*
+Waits for the processes of a foreground job to terminate. SIGTSTP is
+blocked while waiting, so a SIGTSTP received in the meantime is only
+handled after the foreground job is done. The processes are waited for with
+wait4(), so their resource usage is collected at no extra cost and stored
+for the time prefix and status -v.
+
+Receives: -pid_t* pids: pids of the foreground processes, in pipeline order.
+           Entries that are not positive are skipped.
+          -int num_procs: Number of pids.
+          -const struct timespec* start: CLOCK_MONOTONIC time the job was
+           started, for its wall time.
+Returns:  If successful, termination status of the last fg process.
+          If failure, returns -1.
+*/
+	struct rusage usage;
+	struct timespec end;
+	int wstatus = -1;
+	int i;
+	pid_t wait_result = 0;
+	sigset_t sigtstp_set;
 
-	// stdout redirection
-			// If user redirected output, open the stdout_file, otherwise open
-			// /dev/null
-			if (command->stdout_file != NULL)
-				outfile = open(command->stdout_file, O_WRONLY | O_CREAT | O_TRUNC, 0660);
-			else
-				outfile = open(devnull, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	// Normally the parent process has a signal handler for sigtstp. However,
+	// during a fg process, it must ignore sigtstp. This signal set contains
+	// only one signal, SIGTSTP, which will be used below, immediately before
+	// and after waitpid.
+	sigemptyset(&sigtstp_set);
+	sigaddset(&sigtstp_set, SIGTSTP); 
 
-			// Error when opening file, exit failure
-			if (outfile == -1)
-			{
-				exit(1);
-			}
+	// Use the signal set defined above (signal set only contains SIGTSTP) to block
+	// SIGTSTP in the parent process while waiting for the fg process to terminate.
+	sigprocmask(SIG_BLOCK, &sigtstp_set, NULL);
+
+	// Will wait to execute until every child fg process terminates. The
+	// status of a pipeline is the status of its last command. CPU time,
+	// faults and context switches are summed over the processes, max RSS
+	// is the largest of them.
+	memset(&last_usage, 0, sizeof(last_usage));
+	STAT_START(wait_start);
+	for (i = 0; i < num_procs; i++)
+	{
+		if (pids[i] == SPAWN_ERROR || pids[i] == SPAWN_CHILD_ERROR)
+			last_usage.spawn_failed = 1;
+		if (pids[i] <= 0)
+			continue;
+		wait_result = wait4(pids[i], &wstatus, 0, &usage);
+		if (wait_result == -1)
+			continue;
+		trace_exit(pids[i], wstatus);
+
+		timeradd(&last_usage.rusage.ru_utime, &usage.ru_utime, &last_usage.rusage.ru_utime);
+		timeradd(&last_usage.rusage.ru_stime, &usage.ru_stime, &last_usage.rusage.ru_stime);
+		if (usage.ru_maxrss > last_usage.rusage.ru_maxrss)
+			last_usage.rusage.ru_maxrss = usage.ru_maxrss;
+		last_usage.rusage.ru_majflt += usage.ru_majflt;
+		last_usage.rusage.ru_minflt += usage.ru_minflt;
+		last_usage.rusage.ru_nvcsw += usage.ru_nvcsw;
+		last_usage.rusage.ru_nivcsw += usage.ru_nivcsw;
+	}
+	STAT_END(STAT_WAIT, wait_start);
 
-			// Redirect the stdout_file descriptor to point to the file we just
-			// opened
-			dup_result = dup2(outfile, 1);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	last_usage.wall.tv_sec = end.tv_sec - start->tv_sec;
+	last_usage.wall.tv_nsec = end.tv_nsec - start->tv_nsec;
+	if (last_usage.wall.tv_nsec < 0)
+	{
+		last_usage.wall.tv_sec--;
+		last_usage.wall.tv_nsec += 1000000000;
+	}
 
-			// Error during dup2, exit failure.
-			if (dup_result == -1)
-			{
-				exit(1);
-			}
+	// Use the signal set with SIGTSTP to unblock SIGTSTP. Now, the parent process
+	// will handle a SIGTSTP signal like normal (enter/exit fg-only mode).
+	sigprocmask(SIG_UNBLOCK, &sigtstp_set, NULL);
 
-	// Execute the process
-			exec_result = execvp(command->args[0], command->args);
+	// The last process could not be started. If it failed before exec this
+	// is reported the same as a child that exited with 1.
+	if (pids[num_procs - 1] == SPAWN_CHILD_ERROR)
+		return W_EXITCODE(1, 0);
+	if (pids[num_procs - 1] == SPAWN_ERROR)
+		return -1;
 
-			if (exec_result == -1)
-			{
-				exit(1);
-			}
+	// handle waitpid error.
+	if (wait_result == -1)
+	{
+		printf("Error during waitpid\n");
+		fflush(stdout);
+		return -1;
+	}
 
-// Parent Process	
-		default:
-			// Since this is a background process, do not wait for the child.
-			printf("Background pid is %d\n", childPID);	
-			fflush(stdout);
-			return childPID;	
+	// Immediately print message if fg process was terminated by signal.
+	else if (WIFSIGNALED(wstatus))
+	{
+		printf("terminated by signal %d\n", WTERMSIG(wstatus));
+		fflush(stdout);
+		return wstatus;
+	}
+
+	else
+	{
+		return wstatus;
 	}
 }
 
 int fg_proc(struct command_info* command){
 /*
-Uses fork and exec to create a foreground process, and uses waitpid for
-the parent processes to wait until the fg child has terminated.
+Uses the spawn engine to create a foreground process, or one process per
+command of a pipeline, and uses waitpid for the parent processes to wait
+until the fg children have terminated.
 
 Receives: struct command_info* command: Pointer to struct with 
           information for command (args, i/o redirection files).
 
-Returns:  If successful, termination status of fg process.
+Returns:  If successful, termination status of the last fg process.
           If failure, returns -1.
 */
-	
-	// Initialize two sigaction structs, one for SIGTSTP and one
-	// for SIGINT.
-	struct sigaction sigint_action = {0};
-	struct sigaction sigtstp_action = {0};
+	struct timespec start;
+	pid_t pids[count_stages(command)];
+	int num_stages;
+
+	// Create the children. Foreground processes get the default SIGINT
+	// action and ignore SIGTSTP.
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	num_stages = spawn_pipeline(command, 0, pids);
+
+	// The children have their process substitution fds now. The shell
+	// closes its own, so a substitution sees EOF when the stage that
+	// named it is done, not only once the whole pipeline is.
+	end_substs(command);
+
+	// The parent process must wait for the foreground processes to terminate.
+	return wait_fg(pids, num_stages, &start);
+}
 
-	int infile;
-	int outfile;
+static struct job* job_arg(struct job_table* jobs, const char* name, const char* arg){
+/*
+Finds the job named by a builtin's argument, which is either %n for job
+id n or a pid. Prints an error message if there is no such job.
+
+Receives: -struct job_table* jobs: The job table.
+          -const char* name: Name of the builtin, used in error messages.
+          -const char* arg: The argument.
+Returns: struct job*: The job, or NULL if not found.
+*/
+	struct job* job;
+	char* end;
+	long num;
+
+	if (arg == NULL)
+	{
+		printf("%s: job id required\n", name);
+		fflush(stdout);
+		return NULL;
+	}
+
+	num = strtol((*arg == '%') ? arg + 1 : arg, &end, 10);
+	if (*end != '\0')
+		job = NULL;
+	else if (*arg == '%')
+		job = find_job_id(jobs, (int) num);
+	else
+		job = find_job_pid(jobs, (pid_t) num, NULL);
+
+	if (job == NULL)
+	{
+		printf("%s: %s: no such job\n", name, arg);
+		fflush(stdout);
+	}
+
+	return job;
+}
+
+int list_jobs(struct job_table* jobs, struct command_info* command){
+/*
+Built in "jobs" command. Prints every background job in the table with its
+job id, pid, state, elapsed time and command line, in job id order. Jobs
+that have finished are reported and removed first, so they are not listed
+as running, and jobs stopped or continued from outside the shell show
+their current state.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct command_info* command: The jobs command.
+Returns: int: Termination status for the status builtin, exit value 2 for
+              a usage error.
+*/
+	struct timespec now;
+	struct job* job;
+	long elapsed;
+	int i;
+
+	if (command->args[1] != NULL)
+	{
+		printf("usage: jobs\n");
+		fflush(stdout);
+		return W_EXITCODE(2, 0);
+	}
+
+	wait_events(0, jobs);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (i = 0; i < jobs->capacity; i++)
+	{
+		job = &jobs->jobs[i];
+		if (job->state == JOB_FREE || job->state == JOB_DONE)
+			continue;
+		update_stopped(job);
+
+		// Whole seconds, borrowing one if the nanoseconds have not caught up.
+		elapsed = now.tv_sec - job->start.tv_sec - (now.tv_nsec < job->start.tv_nsec);
+		printf("[%d] %d %-7s %ld:%02ld:%02ld %s\n", job->id, job->pid,
+			(job->state == JOB_STOPPED) ? "Stopped" : "Running",
+			elapsed / 3600, (elapsed / 60) % 60, elapsed % 60, job->command);
+	}
+	fflush(stdout);
+	return 0;
+}
+
+int fg_job(struct job_table* jobs, struct command_info* command){
+/*
+Built in "fg" command. Moves a background job to the foreground: the job
+is removed from the table, continued if it was stopped, and waited for like
+any other foreground job. The job keeps its own process group and its
+background signal dispositions, which were set before exec and can't be
+changed from here, so Ctrl-C does not interrupt it.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct command_info* command: The fg command. args[1] names the
+           job as %n or pid.
+Returns: int: Termination status of the job, or exit value 1 if there is
+              no such job.
+*/
+	struct job* job;
+	struct timespec start;
+	pid_t pgid;
+	int was_stopped;
+	int last_done;
 	int wstatus;
-	int dup_result;
-	int exec_result;
-	pid_t wait_result;
-	pid_t childPID;
-	sigset_t sigtstp_set;
+	int num_live = 0;
+	int i;
+
+	if ((job = job_arg(jobs, "fg", command->args[1])) == NULL)
+		return W_EXITCODE(1, 0);
+
+	pid_t pids[job->num_procs];
+
+	// The job is no longer a background job, so stop watching it. Only the
+	// processes that have not been cleaned up yet are waited for.
+	pgid = job->pid;
+	start = job->start;
+	was_stopped = (job->state == JOB_STOPPED);
+	last_done = (job->procs[job->num_procs - 1].pid == 0);
+	wstatus = job->wstatus;
+	for (i = 0; i < job->num_procs; i++)
+	{
+		if (job->procs[i].pid == 0)
+			continue;
+		pids[num_live++] = job->procs[i].pid;
+		unwatch_bg(job, i);
+	}
+	printf("%s\n", job->command);
+	fflush(stdout);
+	remove_job(jobs, job);
 
-	// Normally the parent process has a signal handler for sigtstp. However,
-	// during a fg process, it must ignore sigtstp. This signal set contains
-	// only one signal, SIGTSTP, which will be used below, immediately before
-	// and after waitpid.
-	sigemptyset(&sigtstp_set);
-	sigaddset(&sigtstp_set, SIGTSTP); 
-	
-// Fork child process
-	switch (childPID = fork())
+	if (was_stopped)
+		kill(-pgid, SIGCONT);
+
+	// If the last process is already done, its status is the job's status.
+	if (last_done)
 	{
-// Handle fork error
-		case -1:
-			printf("Error during fork\n");
-			fflush(stdout);
-			return -1;
-
-// Child process
-		case 0:
-	// Set SIGINT handler to default, as we want the child to terminate on
-	// receipt of SIGINT. This is different from the parent, which ignores
-	// SIGINT.
-			sigint_action.sa_handler = SIG_DFL;	
-			sigfillset(&sigint_action.sa_mask);
-			sigint_action.sa_flags = 0;
-			sigaction(SIGINT, &sigint_action, NULL);
-
-	// Set SIGTSTP handler to ignore. All fg processes ignore SIGTSTP.
-			sigtstp_action.sa_handler = SIG_IGN;
-			sigfillset(&sigtstp_action.sa_mask);
-			sigtstp_action.sa_flags = 0;
-			sigaction(SIGTSTP, &sigtstp_action, NULL);
-
-	// stdin redirection
-			// Checks if user specified stdin redirection
-			if (command->stdin_file != NULL)
-			{
-				// Open file that stdin will be redirected to.
-				infile = open(command->stdin_file, O_RDONLY);
+		if (num_live > 0)
+			wait_fg(pids, num_live, &start);
+		return wstatus;
+	}
 
-				// Error opening file. 
-				if (infile == -1)
-				{
-					printf("Error opening file for stdin redirection\n");
-					fflush(stdout);
-					exit(1);
-				}
+	return wait_fg(pids, num_live, &start);
+}
 
-				// Redirect stdin fd to the file we just opened.
-				dup_result = dup2(infile, 0);
+static int signal_number(const char* name){
+/*
+Converts a signal given as a number ("9") or name ("KILL" or "SIGKILL")
+to its number.
 
-				// Error during dup2
-				if (dup_result == -1)
-				{
-					printf("Error while redirecting stdin: dup2() function\n");
-					fflush(stdout);
-					exit(1);
-				}
-			}
+Receives: const char* name: The signal, without the leading '-'.
+Returns: int: The signal number, or -1 if it is not recognized.
+*/
+	static const struct { const char* name; int signo; } names[] = {
+		{"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL},
+		{"USR1", SIGUSR1}, {"USR2", SIGUSR2}, {"ALRM", SIGALRM}, {"TERM", SIGTERM},
+		{"CONT", SIGCONT}, {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}
+	};
+	char* end;
+	long num;
+	size_t i;
+
+	num = strtol(name, &end, 10);
+	if (*name != '\0' && *end == '\0')
+		return (num > 0 && num < NSIG) ? (int) num : -1;
+
+	if (strncmp(name, "SIG", 3) == 0)
+		name += 3;
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+	{
+		if (strcmp(name, names[i].name) == 0)
+			return names[i].signo;
+	}
 
-	// stdout redirection
-			// Checks if user specified stdout redirection
-			if (command->stdout_file != NULL)
-			{
-				// Open file that stdout will be redirected to.
-				outfile = open(command->stdout_file, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	return -1;
+}
 
-				// Error opening file.
-				if (outfile == -1)
-				{
-					perror("open");
-					fflush(stdout);
-					exit(1);
-				}
+int kill_job(struct job_table* jobs, struct command_info* command){
+/*
+Built in "kill" command. Sends a signal (SIGTERM unless given as -SIG) to
+a background job named as %n or by the pid of one of its processes.
+SIGSTOP and SIGCONT also update the job's state in the table. Background
+processes ignore SIGTSTP, so the job is only marked stopped if it did stop.
+
+Receives: -struct job_table* jobs: The job table.
+          -struct command_info* command: The kill command.
+Returns: int: Termination status for the status builtin, exit value 1 if
+              the signal could not be sent.
+*/
+	struct job* job;
+	char** args = command->args + 1;
+	int signo = SIGTERM;
 
-				// Redirect stdout fd to the file we just opened.
-				dup_result = dup2(outfile, 1);
+	// Optional signal argument.
+	if (*args != NULL && **args == '-')
+	{
+		if ((signo = signal_number(*args + 1)) == -1)
+		{
+			printf("kill: %s: invalid signal\n", *args + 1);
+			fflush(stdout);
+			return W_EXITCODE(1, 0);
+		}
+		args++;
+	}
 
-				// Error during dup2
-				if (dup_result == -1)
-				{
-					perror("dup2");
-					fflush(stdout);
-					exit(1);
-				}
-			}
+	if ((job = job_arg(jobs, "kill", *args)) == NULL)
+		return W_EXITCODE(1, 0);
 
-	// Execute command
-			exec_result = execvp(command->args[0], command->args);
+	// Signal the job's process group, which holds every process of a
+	// pipeline, or each process if the group is gone.
+	if (signal_job(job, signo) == -1)
+	{
+		perror("kill");
+		fflush(stdout);
+		return W_EXITCODE(1, 0);
+	}
 
-			if (exec_result == -1)
-			{
-				perror(command->args[0]);
-				fflush(stdout);
-				exit(1);
-			}
+	if (signo == SIGSTOP)
+		job->state = JOB_STOPPED;
+	else if (signo == SIGCONT)
+		job->state = JOB_RUNNING;
+	else
+		update_stopped(job);
 
-// Parent process
-		default:
-			// Use the signal set defined above (signal set only contains SIGTSTP) to block
-			// SIGTSTP in the parent process while waiting for the fg process to terminate.
-			sigprocmask(SIG_BLOCK, &sigtstp_set, NULL);
+	return 0;
+}
 
-			// Will wait to execute until child fg process terminates.
-			wait_result = waitpid(childPID, &wstatus, 0);
+int hash_command(struct command_info* command){
+/*
+Built in "hash" command. With no arguments, prints the cached path of every
+command that has been run. "hash -r" clears the cache. Any other arguments
+are command names to look up and add to the cache.
 
-			// Use the signal set with SIGTSTP to unblock SIGTSTP. Now, the parent process
-			// will handle a SIGTSTP signal like normal (enter/exit fg-only mode).
-			sigprocmask(SIG_UNBLOCK, &sigtstp_set, NULL);
+Receives: struct command_info* command: The hash command.
+Returns: int: Termination status for the status builtin, exit value 1 if
+              any name was not found.
+*/
+	char** name;
+	int result = 0;
 
-			// handle waitpid error.
-			if (wait_result == -1)
-			{
-				printf("Error during waitpid\n");
-				fflush(stdout);
-				return -1;
-			}
+	if (command->args[1] == NULL)
+	{
+		print_path_cache();
+		return 0;
+	}
 
-			// Immediately print message if fg process was terminated by signal.
-			else if (WIFSIGNALED(wstatus))
-			{
-				printf("terminated by signal %d\n", WTERMSIG(wstatus));
-				fflush(stdout);
-				return wstatus;
-			}
+	if (strcmp(command->args[1], "-r") == 0)
+	{
+		clear_path_cache();
+		return 0;
+	}
 
-			else
-			{
-				return wstatus;
-			}
+	for (name = command->args + 1; *name != NULL; name++)
+	{
+		if (lookup_command(*name) == NULL)
+		{
+			printf("hash: %s: not found\n", *name);
+			fflush(stdout);
+			result = W_EXITCODE(1, 0);
+		}
+	}
+
+	return result;
+}
+
+int stats_command(struct command_info* command){
+/*
+Built in "stats" command. Prints the latency histograms of the phases of
+running a command. "stats -r" resets them.
+
+Receives: struct command_info* command: The stats command.
+Returns: int: Termination status for the status builtin, exit value 2 for
+              a usage error.
+*/
+	if (command->args[1] == NULL)
+		print_stats();
+	else if (strcmp(command->args[1], "-r") == 0 && command->args[2] == NULL)
+		reset_stats();
+	else
+	{
+		printf("usage: stats [-r]\n");
+		fflush(stdout);
+		return W_EXITCODE(2, 0);
 	}
+
+	return 0;
 }
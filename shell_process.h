@@ -3,18 +3,39 @@
 
 #include <signal.h>
 #include <sys/types.h>
-#include "list_node.h"
+#include <time.h>
+#include <sys/resource.h>
+#include "job_table.h"
 #include "command_info.h"
 
-void change_dir(struct command_info* command);
-void make_sigtstp_struct(struct sigaction * sig);
+// Resources used by a foreground job, summed over its processes.
+struct fg_usage {
+	struct timespec wall;  // from spawning the job to its last exit
+	struct rusage rusage;  // ru_maxrss is the largest of the processes
+	int spawn_failed;      // 1 if a process could not be started
+};
+
+int change_dir(struct command_info* command);
+void make_sigtstp_struct(struct sigaction * sig, volatile sig_atomic_t* mode);
 void sigtstp_handler(int signo);
-void exit_shell(struct pid_node* list);
+void exit_shell(struct job_table* jobs, int exit_value);
+void stop_jobs(struct job_table* jobs, int timeout_ms);
+void exit_command(struct job_table* jobs, struct command_info* command);
 void make_sigint_struct(struct sigaction * sig);
-void cleanup_bg(struct pid_node* list, struct pid_node** head, struct pid_node** tail);
+int bg_proc_done(struct job_table* jobs, struct job* job, int proc, int wstatus);
+int reap_bg(struct job_table* jobs, struct job* job, int proc);
+int exit_value(int wstatus);
 void status(int fg_status);
-struct pid_node* add_node(pid_t processID);
+int status_command(int fg_status, struct command_info* command);
+void print_usage(void);
+int fg_spawn_failed(void);
+int wait_fg(pid_t* pids, int num_procs, const struct timespec* start);
 int fg_proc(struct command_info* command);
-pid_t bg_proc(struct command_info* command);
+pid_t bg_proc(struct command_info* command, struct job_table* jobs);
+int list_jobs(struct job_table* jobs, struct command_info* command);
+int fg_job(struct job_table* jobs, struct command_info* command);
+int kill_job(struct job_table* jobs, struct command_info* command);
+int hash_command(struct command_info* command);
+int stats_command(struct command_info* command);
 
 #endif // __SHELL_PROCESS_H__
@@ -0,0 +1,567 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "smallsh.h"
+#include "shell_context.h"
+#include "command_info.h"
+#include "input_funcs.h"
+#include "shell_process.h"
+#include "job_table.h"
+#include "arena.h"
+#include "spawn_engine.h"
+#include "event_loop.h"
+#include "parallel.h"
+#include "stats.h"
+#include "trace.h"
+#include "builtins.h"
+#include "placement.h"
+#include "proc_subst.h"
+#include "batch.h"
+#include "cache.h"
+#include "scan.h"
+#include "jobstat.h"
+
+// Set once the process-wide parts (spawn engine, builtins, trace, event
+// loop) have been started, and while a context is open.
+static int process_ready = 0;
+static int context_open = 0;
+
+static int run_command(struct smallsh* shell, struct command_info* command){
+/*
+Runs one pipeline of a command line: a shell builtin, an in-process
+utility, a background job or a foreground job.
+
+Receives: -struct smallsh* shell: The shell's context. Its last_status,
+           printed by status, is updated when the pipeline runs in the
+           foreground.
+          -struct command_info* command: First command of the pipeline.
+Returns: int: The pipeline's status for && and ||: the status of a
+              foreground job, and 0 for a background job or a builtin that
+              does not report one.
+*/
+	struct job_table* jobs = &shell->jobs;
+	int* last_status = &shell->last_status;
+	const struct builtin* builtin = find_builtin(command->args[0]);
+	struct command_info timed;
+	int result;
+
+	// Utilities such as echo, test and printf run in-process, unless
+	// they are part of a pipeline, a background job or have a placement.
+	// Their exit value is the status of the command.
+	if (builtin != NULL && builtin->run != NULL
+		&& command->next_stage == NULL && command->placement == NULL
+		&& !(command->background && shell->fg_only_mode == 0))
+	{
+		*last_status = run_builtin(builtin->run, command);
+		return *last_status;
+	}
+
+	// Builtins that need the shell's state run in the shell itself. They
+	// are only run if the command is not part of a pipeline, except for
+	// cache and time, which run the rest of the pipeline.
+	builtin = find_shell_builtin(command->args[0], command->next_stage != NULL);
+	switch (builtin != NULL ? builtin->id : SHELL_NONE)
+	{
+		// status prints the exit value or signal of the last fg job, and
+		// status -v also the resources it used. It keeps reporting that
+		// job, so only a usage error of its own replaces the status.
+		case SHELL_STATUS:
+			if ((result = status_command(*last_status, command)) != 0)
+				*last_status = result;
+			return result;
+
+		case SHELL_CD:
+			*last_status = change_dir(command);
+			return *last_status;
+
+		// exit_command() exits the shell. It only returns if its
+		// arguments are not valid.
+		case SHELL_EXIT:
+			exit_command(jobs, command);
+			*last_status = W_EXITCODE(2, 0);
+			return *last_status;
+
+		// Job control builtins. jobs lists the background jobs, fg waits
+		// for one in the foreground and kill sends one a signal.
+		case SHELL_JOBS:
+			if ((result = list_jobs(jobs, command)) != 0)
+				*last_status = result;
+			return result;
+
+		case SHELL_FG:
+			*last_status = fg_job(jobs, command);
+			return *last_status;
+
+		case SHELL_KILL:
+			*last_status = kill_job(jobs, command);
+			return *last_status;
+
+		// jobstat shows the CPU, memory and I/O of the background jobs,
+		// once or refreshed with --watch.
+		case SHELL_JOBSTAT:
+			return jobstat_command(jobs, command);
+
+		// stats prints the latency of each phase of running a command,
+		// and stats -r resets it.
+		case SHELL_STATS:
+			if ((result = stats_command(command)) != 0)
+				*last_status = result;
+			return result;
+
+		// hash prints or clears the cache of command paths.
+		case SHELL_HASH:
+			*last_status = hash_command(command);
+			return *last_status;
+
+		// parallel runs a command for every line of its input, with a
+		// bounded number of jobs at a time. It always runs in the
+		// foreground.
+		case SHELL_PARALLEL:
+			*last_status = parallel_command(jobs, command);
+			return *last_status;
+
+		// batch runs a command with a list of args too long for one exec,
+		// split into several commands that each fit in ARG_MAX.
+		case SHELL_BATCH:
+			*last_status = batch_command(jobs, command);
+			return *last_status;
+
+		// cache runs the rest of the command in the foreground, or
+		// replays its output and status if it already ran with the same
+		// inputs.
+		case SHELL_CACHE:
+			*last_status = cache_command(command);
+			return *last_status;
+
+		// time runs the rest of the command in the foreground and reports
+		// the resources it used. On its own, time is run as a program. The
+		// rest is run from a copy of the command whose args start after
+		// "time", so the command itself is unchanged and can run again.
+		// Its report needs the job to finish, so it can't run with &.
+		case SHELL_TIME:
+			if (command->args[1] == NULL)
+				break;
+			if (command->background)
+			{
+				printf("usage: time command [args]\n");
+				fflush(stdout);
+				*last_status = W_EXITCODE(2, 0);
+				return *last_status;
+			}
+			timed = *command;
+			timed.args = command->args + 1;
+			timed.max_args--;
+			*last_status = fg_proc(&timed);
+			print_usage();
+			return *last_status;
+
+		default:
+			break;
+	}
+
+	// If this point is reached, the user did NOT call a built in
+	// function, so we have to fork off a new process. If we are
+	// in normal more and the struct's background flag is set,
+	// run a background process. Only these external commands are
+	// recorded as STAT_COMMAND, not the builtins above.
+	STAT_START(command_start);
+	if (command->background && shell->fg_only_mode == 0)
+	{
+		// Start the background job and add it to the job table. This
+		// will only fail if no process could be started.
+		bg_proc(command, jobs);
+		STAT_END(STAT_COMMAND, command_start);
+		return 0;
+	}
+
+	// If we are in foreground-only mode or if the background flag of the struct
+	// was not set, we will run a foreground command. The parent process must
+	// wait for the foreground process to terminate, so last_status will hold
+	// the termination status of the child.
+	*last_status = fg_proc(command);
+	STAT_END(STAT_COMMAND, command_start);
+	fflush(stdout);
+	return *last_status;
+}
+
+int run_list(struct smallsh* shell, struct command_info* command, struct arena* arena, int exit_on_error){
+/*
+Runs the pipelines of a command list from left to right. After "&&" a
+pipeline only runs if the status so far is 0, and after "||" only if it is
+not. A skipped pipeline leaves the status as it is.
+
+Receives: -struct smallsh* shell: The shell's context.
+          -struct command_info* command: First command of the list.
+          -struct arena* arena: Arena of the command.
+          -int exit_on_error: 1 to exit the shell on the first pipeline that
+           fails (smallsh -e), unless its status is tested by a following
+           "&&" or "||".
+Returns: int: Status of the last pipeline that ran.
+*/
+	enum list_op prev_op = LIST_SEQ;
+	int list_status = 0;
+
+	for (; command != NULL; command = command->next_command)
+	{
+		if ((prev_op == LIST_AND && list_status != 0) || (prev_op == LIST_OR && list_status == 0))
+		{
+			prev_op = command->next_op;
+			continue;
+		}
+		prev_op = command->next_op;
+
+		// Process substitutions start before the pipeline, and the
+		// shell's ends of their pipes are closed once it has started.
+		if (start_substs(command, command->background && shell->fg_only_mode == 0, &shell->jobs, arena) == -1)
+			list_status = W_EXITCODE(1, 0);
+		else
+			list_status = run_command(shell, command);
+		end_substs(command);
+
+		if (exit_on_error && list_status != 0 && prev_op != LIST_AND && prev_op != LIST_OR)
+			exit_shell(&shell->jobs, exit_value(list_status));
+	}
+
+	return list_status;
+}
+
+int init_smallsh(struct smallsh* shell, int watch_stdin){
+/*
+Initializes a shell's context. The first call also starts the parts that
+are shared by the whole process: the spawn engine, the builtins, the trace
+and the event loop.
+
+Receives: -struct smallsh* shell: The context to initialize.
+          -int watch_stdin: 1 if the shell reads commands from stdin and
+           waits for them in the event loop.
+Returns: int: 0 if successful, -1 with errno set if a context is already
+              open (EBUSY) or the event loop could not be created.
+*/
+	if (context_open)
+	{
+		errno = EBUSY;
+		return -1;
+	}
+	context_open = 1;
+
+	shell->last_status = 0;
+	shell->fg_only_mode = 0;
+
+	// Background jobs are tracked in a job table indexed by job id and pid.
+	init_job_table(&shell->jobs);
+
+	if (process_ready)
+		return 0;
+
+	// Start the event loop. From here on, stdin, SIGCHLD and the pidfd of
+	// every background process are waited on together. Without a prompt,
+	// the shell never waits for stdin. This is the only step that can
+	// fail, so it comes first and nothing has to be undone.
+	if (init_events(watch_stdin) == -1)
+	{
+		free_job_table(&shell->jobs);
+		context_open = 0;
+		return -1;
+	}
+	process_ready = 1;
+
+	// In-process builtins write to whatever their stdout is redirected to.
+	// If that reader has gone away, the write fails with EPIPE instead of
+	// killing the shell. Children get the default action back.
+	signal(SIGPIPE, SIG_IGN);
+
+	// Pick the engine used to launch child processes. SMALLSH_SPAWN=fork
+	// selects the original fork()/execvp() path and SMALLSH_SPAWN=zygote
+	// forks a small spawner process now, otherwise posix_spawn is used.
+	select_spawn_engine(getenv("SMALLSH_SPAWN"));
+
+	// Pipes between pipeline commands get the capacity in SMALLSH_PIPE_SIZE,
+	// if set, instead of the kernel default.
+	select_pipe_size(getenv("SMALLSH_PIPE_SIZE"));
+
+	// The lexer's scanner uses AVX2 or SSE2 if the CPU has them, unless
+	// SMALLSH_SCAN picks another one.
+	select_scanner(getenv("SMALLSH_SCAN"));
+
+	// Build the dispatch table of the utilities that run in-process.
+	init_builtins();
+
+	// Every process the shell runs is traced to SMALLSH_TRACE, if set.
+	// The trace is written by a thread that blocks all signals, so signal
+	// handling is not affected.
+	open_trace(getenv("SMALLSH_TRACE"));
+	return 0;
+}
+
+struct smallsh* smallsh_open(void){
+/*
+Opens a context for running commands in this process. The context does not
+watch stdin, and its jobs are only reaped inside the calls below.
+
+Receives: Nothing
+Returns: struct smallsh*: The context, or NULL with errno set: EBUSY if
+                          one is already open, or the error that kept it
+                          from being created.
+*/
+	struct smallsh* shell = malloc(sizeof(struct smallsh));
+
+	if (shell == NULL)
+		return NULL;
+	if (init_smallsh(shell, 0) == -1)
+	{
+		free(shell);
+		return NULL;
+	}
+
+	return shell;
+}
+
+void smallsh_close(struct smallsh* shell, int timeout_ms){
+/*
+Closes a context. Its jobs that are still running get SIGTERM, and SIGKILL
+after timeout_ms, as when the shell exits.
+
+Receives: -struct smallsh* shell: The context.
+          -int timeout_ms: How long jobs have to exit after SIGTERM.
+Returns: Nothing
+*/
+	stop_jobs(&shell->jobs, timeout_ms);
+	free_job_table(&shell->jobs);
+	free(shell);
+	context_open = 0;
+}
+
+void smallsh_set_fg_only(struct smallsh* shell, int fg_only){
+/*
+Turns foreground-only mode on or off. In this mode, & is ignored by
+smallsh_run(), as after SIGTSTP in the interactive shell.
+
+Receives: -struct smallsh* shell: The context.
+          -int fg_only: 1 for on, 0 for off.
+Returns: Nothing
+*/
+	shell->fg_only_mode = fg_only;
+}
+
+struct smallsh_command* smallsh_parse(const char* line){
+/*
+Parses one line of smallsh syntax: a command list with pipelines,
+redirections, here-strings, process substitutions, placement prefixes and
+&. "$$" is expanded to the pid of the process. Here-documents need the
+lines after the command, so they are not accepted here.
+
+Receives: const char* line: The line, without a newline.
+Returns: struct smallsh_command*: The parsed command, freed with
+         smallsh_free(). NULL if the line is empty or a comment, or if it
+         is not valid, after printing an error.
+*/
+	struct smallsh_command* command;
+	struct command_info* pipeline;
+	struct command_info* stage;
+	char* copy;
+
+	command = malloc(sizeof(struct smallsh_command));
+	if (command == NULL)
+	{
+		perror("malloc");
+		return NULL;
+	}
+	init_arena(&command->arena);
+	init_arena(&command->run_arena);
+	copy = arena_strndup(&command->arena, line, strlen(line));
+
+	if (*copy == '\0' || comment_or_space(copy)
+		|| tokenize(copy, &command->info, &command->arena) == -1)
+	{
+		smallsh_free(command);
+		return NULL;
+	}
+
+	for (pipeline = &command->info; pipeline != NULL; pipeline = pipeline->next_command)
+	{
+		for (stage = pipeline; stage != NULL; stage = stage->next_stage)
+		{
+			if (stage->heredoc_end != NULL)
+			{
+				printf("here-documents are not supported by smallsh_parse(), use <<<\n");
+				fflush(stdout);
+				smallsh_free(command);
+				return NULL;
+			}
+		}
+
+		if (parse_placement(pipeline, &command->arena) == -1)
+		{
+			smallsh_free(command);
+			return NULL;
+		}
+	}
+
+	return command;
+}
+
+void smallsh_free(struct smallsh_command* command){
+/*
+Frees a command returned by smallsh_parse().
+
+Receives: struct smallsh_command* command: The command, or NULL.
+Returns: Nothing
+*/
+	if (command == NULL)
+		return;
+	free_arena(&command->arena);
+	free_arena(&command->run_arena);
+	free(command);
+}
+
+int smallsh_run(struct smallsh* shell, struct smallsh_command* command){
+/*
+Runs a command the way the shell runs a line of input: builtins run in
+this process, foreground pipelines are waited for and background ones are
+added to the context's job table. Note that exit ends this process. A
+command can be run any number of times: prefixes such as time and cache
+are skipped in a copy, and process substitutions are parsed into the run
+arena, which is reset by every run.
+
+Receives: -struct smallsh* shell: The context.
+          -struct smallsh_command* command: The command.
+Returns: int: Termination status of the list, as from waitpid().
+*/
+	arena_reset(&command->run_arena);
+	return run_list(shell, &command->info, &command->run_arena, 0);
+}
+
+int smallsh_spawn(struct smallsh* shell, struct smallsh_command* command){
+/*
+Starts a pipeline as a job of the context and returns without waiting for
+it. The job is not reported when it is done. Its status is collected with
+smallsh_wait(). The processes inherit this process's stdin and stdout
+unless redirected, and & is ignored. Builtins are not run in-process, so
+they must exist as programs.
+
+Receives: -struct smallsh* shell: The context.
+          -struct smallsh_command* command: The command. A list (;, && or
+           ||) is not accepted.
+Returns: int: The job id, or -1 if no process could be started (errno is
+              EINVAL for a list).
+*/
+	struct command_info* pipeline = &command->info;
+	char job_line[256];
+	struct job* job;
+	pid_t pids[count_stages(pipeline)];
+	int num_stages;
+	int num_procs = 0;
+	int i;
+
+	if (pipeline->next_command != NULL)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	arena_reset(&command->run_arena);
+	if (start_substs(pipeline, 0, &shell->jobs, &command->run_arena) == -1)
+		return -1;
+	num_stages = spawn_pipeline(pipeline, 0, pids);
+	end_substs(pipeline);
+
+	// Keep the processes that were started, like bg_proc().
+	for (i = 0; i < num_stages; i++)
+	{
+		if (pids[i] > 0)
+			pids[num_procs++] = pids[i];
+	}
+	if (num_procs == 0)
+		return -1;
+
+	command_line(pipeline, job_line, sizeof(job_line));
+	job = add_job(&shell->jobs, pids, num_procs, job_line);
+	job->quiet = QUIET_KEEP;
+	for (i = 0; i < num_procs; i++)
+		watch_bg(job, i);
+
+	return job->id;
+}
+
+int smallsh_wait(struct smallsh* shell, int job_id, int* wstatus){
+/*
+Waits for a job started by smallsh_spawn() and removes it. Other jobs that
+are done in the meantime are kept until they are waited for.
+
+Receives: -struct smallsh* shell: The context.
+          -int job_id: The job id.
+          -int* wstatus: Set to the termination status of the job's last
+           process, as from waitpid(). Can be NULL.
+Returns: int: 0 if successful, -1 with errno set to ECHILD if there is no
+              such spawned job.
+*/
+	struct job* job = find_job_id(&shell->jobs, job_id);
+
+	if (job == NULL || job->quiet != QUIET_KEEP)
+	{
+		errno = ECHILD;
+		return -1;
+	}
+
+	while (job->state != JOB_DONE)
+		wait_events(-1, &shell->jobs);
+
+	if (wstatus != NULL)
+		*wstatus = job->wstatus;
+	remove_job(&shell->jobs, job);
+	return 0;
+}
+
+static int done_jobs(struct smallsh* shell, int* job_ids, int max_ids){
+/*
+Lists the spawned jobs that are done and not waited for yet.
+
+Receives: -struct smallsh* shell: The context.
+          -int* job_ids: Filled with their job ids.
+          -int max_ids: Size of job_ids.
+Returns: int: Number of job ids.
+*/
+	struct job* job;
+	int count = 0;
+	int i;
+
+	for (i = 0; i < shell->jobs.capacity && count < max_ids; i++)
+	{
+		job = &shell->jobs.jobs[i];
+		if (job->state == JOB_DONE && job->quiet == QUIET_KEEP)
+			job_ids[count++] = job->id;
+	}
+
+	return count;
+}
+
+int smallsh_poll_jobs(struct smallsh* shell, int timeout_ms, int* job_ids, int max_ids){
+/*
+Cleans up the context's jobs that have terminated, reporting background
+jobs started by smallsh_run() as the shell does, and lists the spawned jobs
+that are done. Waits up to timeout_ms if none are done yet.
+
+Receives: -struct smallsh* shell: The context.
+          -int timeout_ms: Milliseconds to wait, -1 to wait until a job
+           terminates, 0 to not wait.
+          -int* job_ids: Filled with the ids of the done spawned jobs, to
+           pass to smallsh_wait().
+          -int max_ids: Size of job_ids.
+Returns: int: Number of job ids.
+*/
+	int count;
+
+	wait_events(0, &shell->jobs);
+	count = done_jobs(shell, job_ids, max_ids);
+	if (count > 0 || timeout_ms == 0 || shell->jobs.count == 0)
+		return count;
+
+	wait_events(timeout_ms, &shell->jobs);
+	return done_jobs(shell, job_ids, max_ids);
+}
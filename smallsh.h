@@ -0,0 +1,35 @@
+#ifndef __SMALLSH_H__
+#define __SMALLSH_H__
+
+// C API of libsmallsh, which runs smallsh commands inside a host process.
+// A context holds the state a shell keeps between commands: its job table,
+// the status of the last foreground command and foreground-only mode.
+// Commands are parsed once and can then be run the way the shell runs them,
+// builtins included, or spawned as jobs and waited for later.
+//
+// The event loop and the handling of SIGCHLD are per process, so only one
+// context can be open at a time. Opening it blocks SIGCHLD in the calling
+// thread, and children are waited for by pid, so the host should not reap
+// them with waitpid(-1) itself. SIGPIPE is ignored from then on, so a
+// builtin writing to a closed pipe gets EPIPE instead of ending the host.
+
+// libsmallsh is built with hidden visibility, so these are the only
+// symbols the shared library exports.
+#define SMALLSH_API __attribute__((visibility("default")))
+
+struct smallsh;
+struct smallsh_command;
+
+SMALLSH_API struct smallsh* smallsh_open(void);
+SMALLSH_API void smallsh_close(struct smallsh* shell, int timeout_ms);
+SMALLSH_API void smallsh_set_fg_only(struct smallsh* shell, int fg_only);
+
+SMALLSH_API struct smallsh_command* smallsh_parse(const char* line);
+SMALLSH_API void smallsh_free(struct smallsh_command* command);
+
+SMALLSH_API int smallsh_run(struct smallsh* shell, struct smallsh_command* command);
+SMALLSH_API int smallsh_spawn(struct smallsh* shell, struct smallsh_command* command);
+SMALLSH_API int smallsh_wait(struct smallsh* shell, int job_id, int* wstatus);
+SMALLSH_API int smallsh_poll_jobs(struct smallsh* shell, int timeout_ms, int* job_ids, int max_ids);
+
+#endif // __SMALLSH_H__
@@ -0,0 +1,702 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "spawn_engine.h"
+#include "command_info.h"
+#include "path_cache.h"
+#include "stats.h"
+#include "trace.h"
+#include "placement.h"
+#include "zygote.h"
+#include "proc_subst.h"
+
+extern char** environ;
+
+// Engine used by spawn_pipeline(). Chosen once at startup by
+// select_spawn_engine(), defaults to posix_spawn.
+static enum spawn_engine engine = SPAWN_ENGINE_POSIX;
+
+// Capacity requested for every pipeline pipe with F_SETPIPE_SZ. 0 keeps the
+// kernel default (64KB). Chosen once at startup by select_pipe_size().
+static int pipe_size = 0;
+
+void select_spawn_engine(const char* name){
+/*
+Selects the engine used to launch child processes. Called at the start of
+main with the value of the SMALLSH_SPAWN environment variable so the two
+engines can be compared without rebuilding the shell.
+
+The zygote engine starts its helper process here, while the shell is still
+small. If it can't be started, the default is kept.
+
+Receives: const char* name: "fork", "posix" or "zygote". NULL or any other
+                            value keeps the default (posix).
+Returns: Nothing
+*/
+	if (name != NULL && strcmp(name, "fork") == 0)
+		engine = SPAWN_ENGINE_FORK;
+	else if (name != NULL && strcmp(name, "zygote") == 0 && start_zygote() == 0)
+		engine = SPAWN_ENGINE_ZYGOTE;
+	else
+		engine = SPAWN_ENGINE_POSIX;
+}
+
+void select_pipe_size(const char* size){
+/*
+Sets the capacity of the pipes created between pipeline commands. Called
+at the start of main with the value of the SMALLSH_PIPE_SIZE environment
+variable. Larger pipes mean fewer context switches for high throughput
+stages. The kernel rounds the size up to a power of two pages and refuses
+sizes above /proc/sys/fs/pipe-max-size for unprivileged users, in which
+case the default is kept. A value that is not a number from 0 to INT_MAX
+is reported and ignored.
+
+Receives: const char* size: Size in bytes, NULL to keep the default.
+Returns: Nothing
+*/
+	char* end;
+	long value;
+
+	if (size == NULL)
+		return;
+
+	errno = 0;
+	value = strtol(size, &end, 10);
+	if (end == size || *end != '\0' || errno == ERANGE || value < 0 || value > INT_MAX)
+	{
+		fprintf(stderr, "smallsh: SMALLSH_PIPE_SIZE: %s: invalid size\n", size);
+		return;
+	}
+
+	pipe_size = value;
+}
+
+void child_signals(int background){
+/*
+Sets up the signal dispositions and mask of a new child before exec. Used
+by the fork engine and the zygote.
+
+Receives: int background: 1 if the child is a background process, 0 if not.
+Returns: Nothing
+*/
+	struct sigaction sigint_action = {0};
+	struct sigaction sigtstp_action = {0};
+	struct sigaction sigpipe_action = {0};
+	sigset_t empty_mask;
+
+	// Foreground processes set SIGINT to default, as we want the child to
+	// terminate on receipt of SIGINT. Background processes keep ignoring
+	// SIGINT, like the parent.
+	if (!background)
+	{
+		sigint_action.sa_handler = SIG_DFL;
+		sigfillset(&sigint_action.sa_mask);
+		sigint_action.sa_flags = 0;
+		sigaction(SIGINT, &sigint_action, NULL);
+	}
+
+	// Ignore SIGTSTP. This must be done in the child because the parent
+	// process does not ignore SIGTSTP.
+	sigtstp_action.sa_handler = SIG_IGN;
+	sigfillset(&sigtstp_action.sa_mask);
+	sigtstp_action.sa_flags = 0;
+	sigaction(SIGTSTP, &sigtstp_action, NULL);
+
+	// The shell ignores SIGPIPE for its in-process builtins. The child gets
+	// the default action back, so a writer in a pipeline dies when its
+	// reader goes away.
+	sigpipe_action.sa_handler = SIG_DFL;
+	sigaction(SIGPIPE, &sigpipe_action, NULL);
+
+	// The shell blocks SIGCHLD for its event loop. The child starts with
+	// nothing blocked.
+	sigemptyset(&empty_mask);
+	sigprocmask(SIG_SETMASK, &empty_mask, NULL);
+}
+
+void exec_child(char** args, const char* path, int background){
+/*
+Executes the command in a new child. Does not return: if the exec fails,
+the error is printed (for a foreground process) and the child exits with
+a value of 1. Used by the fork engine and the zygote.
+
+Receives: -char** args: The command and its args.
+          -const char* path: Path of the program from the PATH cache, or
+           NULL to search PATH with execvp().
+          -int background: 1 if the child is a background process, 0 if not.
+Returns: Nothing
+*/
+	// The cached path is executed directly. If it no longer exists, fall
+	// back to searching PATH.
+	if (path != NULL)
+		execve(path, args, environ);
+	if (path == NULL || errno == ENOENT)
+		execvp(args[0], args);
+
+	if (!background)
+	{
+		perror(args[0]);
+		fflush(stdout);
+	}
+	exit(1);
+}
+
+static pid_t spawn_fork(struct command_info* command, int background, struct spawn_io* io,
+	const char* path, const struct placement* placement){
+/*
+Original launch path. Uses fork and exec, and sets up signal dispositions,
+process group, CPU and priority placement and i/o redirection by hand in
+the child.
+
+Receives: -struct command_info* command: Pointer to struct with information
+           for command (args, i/o redirection files).
+          -int background: 1 if the child is a background process, 0 if not.
+          -struct spawn_io* io: Pipe ends and process group for the child.
+          -const char* path: Path of the program from the PATH cache, or
+           NULL to search PATH with execvp().
+          -const struct placement* placement: Placement of the job, or NULL.
+
+Returns: pid of the child, or SPAWN_ERROR if fork failed.
+*/
+	int infile;
+	int outfile;
+	int dup_result;
+	char devnull[] = "/dev/null";
+	pid_t childPID;
+
+// Create child process
+	switch (childPID = fork())
+	{
+
+// Handle fork error
+		case -1:
+			printf("Error during fork\n");
+			fflush(stdout);
+			return SPAWN_ERROR;
+
+// Child process
+		case 0:
+	// Signal dispositions and mask of a fg or bg child.
+			child_signals(background);
+
+	// Join the job's process group, if it has one.
+			if (io->pgid != -1)
+				setpgid(0, io->pgid);
+
+	// CPU affinity, nice value, scheduling class and I/O priority.
+			if (placement != NULL && apply_placement(placement) == -1)
+				exit(1);
+
+	// Pipes. The pipe ends are close-on-exec, but dup2 clears the flag on
+	// the copy, so only stdin and stdout stay open across exec.
+			if (io->stdin_fd != -1)
+				dup2(io->stdin_fd, 0);
+			if (io->stdout_fd != -1)
+				dup2(io->stdout_fd, 1);
+
+	// stdin redirection
+			// If user redirected input, open the stdin_file. Background
+			// processes without a redirect or pipe read from /dev/null.
+			infile = -2;
+			if (command->stdin_file != NULL)
+				infile = open(command->stdin_file, O_RDONLY);
+			else if (background && io->stdin_fd == -1)
+				infile = open(devnull, O_RDONLY);
+
+			if (infile != -2)
+			{
+				// Error opening file.
+				if (infile == -1)
+				{
+					if (!background)
+					{
+						printf("Error opening file for stdin redirection\n");
+						fflush(stdout);
+					}
+					exit(1);
+				}
+
+				// Redirect stdin fd to the file we just opened.
+				dup_result = dup2(infile, 0);
+
+				// Error during dup2
+				if (dup_result == -1)
+				{
+					if (!background)
+					{
+						printf("Error while redirecting stdin: dup2() function\n");
+						fflush(stdout);
+					}
+					exit(1);
+				}
+			}
+
+	// stdout redirection
+			// If user redirected output, open the stdout_file. Background
+			// processes without a redirect or pipe write to /dev/null.
+			outfile = -2;
+			if (command->stdout_file != NULL)
+				outfile = open(command->stdout_file, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+			else if (background && io->stdout_fd == -1)
+				outfile = open(devnull, O_WRONLY | O_CREAT | O_TRUNC, 0660);
+
+			if (outfile != -2)
+			{
+				// Error opening file.
+				if (outfile == -1)
+				{
+					if (!background)
+					{
+						printf("open: %s: %s\n", command->stdout_file, strerror(errno));
+						fflush(stdout);
+					}
+					exit(1);
+				}
+
+				// Redirect stdout fd to the file we just opened.
+				dup_result = dup2(outfile, 1);
+
+				// Error during dup2
+				if (dup_result == -1)
+				{
+					if (!background)
+					{
+						perror("dup2");
+						fflush(stdout);
+					}
+					exit(1);
+				}
+			}
+
+	// Execute command.
+			exec_child(command->args, path, background);
+
+// Parent process
+		default:
+			// Also set the process group from the parent, so it is in place
+			// before the next stage of the pipeline tries to join it.
+			if (io->pgid != -1)
+				setpgid(childPID, io->pgid ? io->pgid : childPID);
+			return childPID;
+	}
+}
+
+static int can_create(const char* path){
+/*
+Checks whether a file could be opened for writing, creating it if it does
+not exist yet. Used by report_spawn_failure().
+
+Receives: const char* path: Path of the file.
+Returns: int: 1 if it could, 0 otherwise.
+*/
+	char dir[PATH_MAX];
+	const char* slash;
+
+	if (access(path, W_OK) == 0)
+		return 1;
+	if (errno != ENOENT)
+		return 0;
+
+	// The file is missing, so its directory has to exist and be writable.
+	if ((slash = strrchr(path, '/')) == NULL)
+		return access(".", W_OK | X_OK) == 0;
+	if (slash == path)
+		return access("/", W_OK | X_OK) == 0;
+	if ((size_t) (slash - path) >= sizeof(dir))
+		return 0;
+
+	memcpy(dir, path, slash - path);
+	dir[slash - path] = '\0';
+	return access(dir, W_OK | X_OK) == 0;
+}
+
+static void report_spawn_failure(struct command_info* command, int error){
+/*
+Prints an error message after posix_spawn() failed. posix_spawn() only
+gives us an errno, so the redirection files are checked again here to
+work out which step failed. This only runs on the failure path.
+
+Receives: -struct command_info* command: The command that failed to start.
+          -int error: The value returned by posix_spawn().
+Returns: Nothing
+*/
+	if (command->stdin_file != NULL && access(command->stdin_file, R_OK) == -1)
+		printf("Error opening file for stdin redirection\n");
+
+	// ENOENT and EACCES can come from the exec too, so they only belong to
+	// the stdout file if it can't be opened.
+	else if (command->stdout_file != NULL
+		&& ((error != ENOENT && error != EACCES) || !can_create(command->stdout_file)))
+		printf("open: %s: %s\n", command->stdout_file, strerror(error));
+
+	else
+		printf("%s: %s\n", command->args[0], strerror(error));
+
+	fflush(stdout);
+}
+
+static pid_t spawn_posix(struct command_info* command, int background, struct spawn_io* io, const char* path){
+/*
+Launches a child with posix_spawn(). The pipes and i/o redirections are
+passed as file actions and the SIGINT disposition and process group as
+spawn attributes, so nothing has to run in the child between creation and
+exec.
+
+Receives: -struct command_info* command: Pointer to struct with information
+           for command (args, i/o redirection files).
+          -int background: 1 if the child is a background process, 0 if not.
+          -struct spawn_io* io: Pipe ends and process group for the child.
+          -const char* path: Path of the program from the PATH cache, or
+           NULL to search PATH with posix_spawnp().
+
+Returns: pid of the child, or SPAWN_CHILD_ERROR if the child could not be
+         started.
+*/
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	struct sigaction ignore_action = {0};
+	struct sigaction saved_action;
+	sigset_t default_set;
+	sigset_t child_mask;
+	sigset_t sigtstp_set;
+	sigset_t old_mask;
+	sigset_t pending;
+	short flags;
+	int refire;
+	int result;
+	pid_t childPID;
+
+	// Pipes first, so an explicit redirection replaces them. The pipe ends
+	// are close-on-exec, the dup2 copies are not.
+	posix_spawn_file_actions_init(&actions);
+	if (io->stdin_fd != -1)
+		posix_spawn_file_actions_adddup2(&actions, io->stdin_fd, 0);
+	if (io->stdout_fd != -1)
+		posix_spawn_file_actions_adddup2(&actions, io->stdout_fd, 1);
+
+	// Redirections. Background processes without a redirect or pipe use
+	// /dev/null.
+	if (command->stdin_file != NULL)
+		posix_spawn_file_actions_addopen(&actions, 0, command->stdin_file, O_RDONLY, 0);
+	else if (background && io->stdin_fd == -1)
+		posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+
+	if (command->stdout_file != NULL)
+		posix_spawn_file_actions_addopen(&actions, 1, command->stdout_file,
+			O_WRONLY | O_CREAT | O_TRUNC, 0660);
+	else if (background && io->stdout_fd == -1)
+		posix_spawn_file_actions_addopen(&actions, 1, "/dev/null",
+			O_WRONLY | O_CREAT | O_TRUNC, 0660);
+
+	// Foreground children get the default SIGINT action, background children
+	// keep ignoring it. SIGPIPE, which the shell ignores, is always reset.
+	// The child always starts with an empty signal mask.
+	posix_spawnattr_init(&attr);
+	sigemptyset(&default_set);
+	sigaddset(&default_set, SIGPIPE);
+	if (!background)
+		sigaddset(&default_set, SIGINT);
+	sigemptyset(&child_mask);
+	posix_spawnattr_setsigdefault(&attr, &default_set);
+	posix_spawnattr_setsigmask(&attr, &child_mask);
+	flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+
+	// Join the job's process group, if it has one.
+	if (io->pgid != -1)
+	{
+		posix_spawnattr_setpgroup(&attr, io->pgid);
+		flags |= POSIX_SPAWN_SETPGROUP;
+	}
+	posix_spawnattr_setflags(&attr, flags);
+
+	// Spawn attributes can only reset signals to default, but every child
+	// must ignore SIGTSTP. Ignored signals are inherited across exec, so the
+	// parent ignores SIGTSTP while the child is created. SIGTSTP is blocked
+	// around the switch, and one that was already pending is raised again
+	// afterwards, because setting SIG_IGN discards pending signals.
+	sigemptyset(&sigtstp_set);
+	sigaddset(&sigtstp_set, SIGTSTP);
+	sigprocmask(SIG_BLOCK, &sigtstp_set, &old_mask);
+	sigpending(&pending);
+	refire = sigismember(&pending, SIGTSTP);
+
+	ignore_action.sa_handler = SIG_IGN;
+	sigfillset(&ignore_action.sa_mask);
+	sigaction(SIGTSTP, &ignore_action, &saved_action);
+
+	// The cached path is spawned directly. If it no longer exists, it is
+	// removed from the cache and PATH is searched again.
+	if (path != NULL)
+	{
+		result = posix_spawn(&childPID, path, &actions, &attr, command->args, environ);
+		if (result == ENOENT && path != command->args[0] && access(path, X_OK) == -1)
+		{
+			forget_command(command->args[0]);
+			path = lookup_command(command->args[0]);
+			if (path != NULL)
+				result = posix_spawn(&childPID, path, &actions, &attr, command->args, environ);
+		}
+	}
+	if (path == NULL)
+		result = posix_spawnp(&childPID, command->args[0], &actions, &attr,
+			command->args, environ);
+
+	sigaction(SIGTSTP, &saved_action, NULL);
+	if (refire)
+		raise(SIGTSTP);
+	sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+
+	// posix_spawn reports redirection and exec failures directly, so they
+	// are reported here instead of from the child.
+	if (result != 0)
+	{
+		report_spawn_failure(command, result);
+		return SPAWN_CHILD_ERROR;
+	}
+
+	return childPID;
+}
+
+int open_stdin_data(const char* data){
+/*
+Creates a file descriptor that reads a here-document or here-string, so it
+can be given to a child as stdin without a temporary file. Data that fits
+in PIPE_BUF is written to a pipe, which can't block. Anything larger goes
+to a memfd, an anonymous file that only exists in memory.
+
+Receives: const char* data: The contents.
+Returns: int: A close-on-exec fd positioned at the start of the data, or
+              -1 if it could not be created, after printing an error.
+*/
+	size_t len = strlen(data);
+	size_t written = 0;
+	ssize_t result;
+	int fds[2];
+	int fd;
+
+	if (len <= PIPE_BUF)
+	{
+		if (pipe2(fds, O_CLOEXEC) == -1)
+		{
+			perror("pipe");
+			fflush(stdout);
+			return -1;
+		}
+		if (len > 0 && write(fds[1], data, len) == -1)
+			perror("write");
+		close(fds[1]);
+		return fds[0];
+	}
+
+	if ((fd = memfd_create("smallsh-heredoc", MFD_CLOEXEC)) == -1)
+	{
+		perror("memfd_create");
+		fflush(stdout);
+		return -1;
+	}
+	while (written < len)
+	{
+		if ((result = write(fd, data + written, len - written)) == -1)
+		{
+			perror("write");
+			fflush(stdout);
+			close(fd);
+			return -1;
+		}
+		written += result;
+	}
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+int count_stages(struct command_info* command){
+/*
+Counts the commands in a pipeline.
+
+Receives: struct command_info* command: First command of the pipeline.
+Returns: int: Number of commands, at least 1.
+*/
+	int num_stages = 0;
+
+	for (; command != NULL; command = command->next_stage)
+		num_stages++;
+
+	return num_stages;
+}
+
+static int abort_pipeline(pid_t* pids, int num_stages){
+/*
+Stops the processes of a pipeline that could not be started completely.
+They are killed and waited for here, and their entries become SPAWN_ERROR
+so the caller does not wait for them again. The stage that failed gets
+SPAWN_ERROR too, and the ones after it get no entry.
+
+Receives: -pid_t* pids: The entries of the stages started so far.
+          -int num_stages: Number of entries, the index of the stage that
+           failed.
+Returns: int: Number of entries, num_stages + 1.
+*/
+	int wstatus;
+	int i;
+
+	for (i = 0; i < num_stages; i++)
+	{
+		if (pids[i] <= 0)
+			continue;
+		kill(pids[i], SIGKILL);
+		if (waitpid(pids[i], &wstatus, 0) == pids[i])
+			trace_exit(pids[i], wstatus);
+		pids[i] = SPAWN_ERROR;
+	}
+
+	pids[num_stages] = SPAWN_ERROR;
+	return num_stages + 1;
+}
+
+int spawn_pipeline(struct command_info* command, int background, pid_t* pids){
+/*
+Launches every command of a pipeline using the selected engine, connecting
+each command's stdout to the next one's stdin with a pipe. The children get
+the signal dispositions and redirections of a fg or bg process. Background
+pipelines are put in a new process group led by their first process, so
+the whole job can be signaled at once. Foreground pipelines stay in the
+shell's process group so they keep receiving SIGINT from the terminal.
+The placement of the first command, if any, applies to every command.
+The caller is responsible for waiting on the children.
+
+Receives: -struct command_info* command: First command of the pipeline.
+          -int background: 1 if the children are background processes.
+          -pid_t* pids: Filled with one entry per command: the pid of the
+           child, SPAWN_ERROR if no process could be created, or
+           SPAWN_CHILD_ERROR if a redirection or exec failed. If a pipe
+           can't be created, the stages already started are killed and
+           reaped, and every entry up to that stage is SPAWN_ERROR.
+
+Returns: int: Number of entries, the number of commands in the pipeline
+              unless a pipe could not be created.
+*/
+	struct spawn_io io;
+	struct placement* placement = command->placement;
+	struct timespec fork_time;
+	struct timespec exec_time;
+	const char* path;
+	int pipe_fds[2];
+	int prev_read = -1;
+	int data_fd;
+	int start;
+	int retry;
+	int num_stages = 0;
+
+	io.pgid = background ? 0 : -1;
+
+	for (; command != NULL; command = command->next_stage)
+	{
+		// Every command but the last writes to a new pipe.
+		io.stdin_fd = prev_read;
+		io.stdout_fd = -1;
+		pipe_fds[0] = -1;
+		// Without the pipe, the rest of the pipeline can't be connected,
+		// so the stages already started are stopped and none is run.
+		if (command->next_stage != NULL)
+		{
+			if (pipe2(pipe_fds, O_CLOEXEC) == -1)
+			{
+				perror("pipe");
+				fflush(stdout);
+				if (prev_read != -1)
+					close(prev_read);
+				return abort_pipeline(pids, num_stages);
+			}
+			if (pipe_size > 0)
+				fcntl(pipe_fds[1], F_SETPIPE_SZ, pipe_size);
+			io.stdout_fd = pipe_fds[1];
+		}
+
+		// A here-document or here-string replaces the pipe from the
+		// previous command. If its fd can't be created, the command fails
+		// like a bad redirection.
+		data_fd = -1;
+		start = 1;
+		if (command->stdin_data != NULL)
+		{
+			data_fd = open_stdin_data(command->stdin_data);
+			io.stdin_fd = data_fd;
+			if (data_fd == -1)
+			{
+				pids[num_stages++] = SPAWN_CHILD_ERROR;
+				start = 0;
+			}
+		}
+
+		if (start)
+		{
+			// Find the program in the PATH cache, so the child can exec it
+			// without searching every PATH directory.
+			path = lookup_command(command->args[0]);
+
+			STAT_START(spawn_start);
+			clock_gettime(CLOCK_REALTIME, &fork_time);
+			// posix_spawn can't set the CPU affinity or I/O priority of the
+			// child, so a job with a placement uses fork unless the zygote
+			// runs. If the zygote has gone away, posix_spawn takes over. A
+			// command is only started again if its request never reached
+			// the zygote, which may otherwise have started it already.
+			retry = 1;
+			inherit_substs(command, 1);
+			if (engine == SPAWN_ENGINE_ZYGOTE && zygote_running())
+			{
+				pids[num_stages] = zygote_spawn(command, background, &io, path, placement);
+				retry = (pids[num_stages] == ZYGOTE_NOT_SENT);
+				if (retry)
+					pids[num_stages] = SPAWN_ERROR;
+			}
+			if (engine == SPAWN_ENGINE_ZYGOTE && !zygote_running())
+				engine = SPAWN_ENGINE_POSIX;
+
+			if (engine != SPAWN_ENGINE_ZYGOTE && retry)
+			{
+				if (engine == SPAWN_ENGINE_FORK || placement != NULL)
+					pids[num_stages] = spawn_fork(command, background, &io, path, placement);
+				else
+					pids[num_stages] = spawn_posix(command, background, &io, path);
+			}
+			inherit_substs(command, 0);
+			clock_gettime(CLOCK_REALTIME, &exec_time);
+			STAT_END(STAT_SPAWN, spawn_start);
+
+			if (pids[num_stages] > 0)
+				trace_spawn(command, pids[num_stages], background, &fork_time, &exec_time);
+
+			// The first process that starts leads the job's process group.
+			if (io.pgid == 0 && pids[num_stages] > 0)
+				io.pgid = pids[num_stages];
+			num_stages++;
+		}
+
+		// The children have their own copies of the pipe ends now.
+		if (data_fd != -1)
+			close(data_fd);
+		if (prev_read != -1)
+			close(prev_read);
+		if (io.stdout_fd != -1)
+			close(io.stdout_fd);
+		prev_read = pipe_fds[0];
+	}
+
+	return num_stages;
+}
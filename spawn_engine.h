@@ -0,0 +1,41 @@
+#ifndef __SPAWN_ENGINE_H__
+#define __SPAWN_ENGINE_H__
+
+#include <sys/types.h>
+#include "command_info.h"
+
+// Engines that can be used to launch a child process. The fork engine is
+// the original fork()/execvp() path and is kept as a fallback. The posix
+// engine uses posix_spawnp(), which avoids copying the shell's page tables.
+// The zygote engine forks from a small helper process, see zygote.c.
+enum spawn_engine {
+	SPAWN_ENGINE_FORK,
+	SPAWN_ENGINE_POSIX,
+	SPAWN_ENGINE_ZYGOTE
+};
+
+// Pipe ends and process group used to launch one command of a pipeline.
+struct spawn_io {
+	int stdin_fd;  // read end of the pipe from the previous command, or -1
+	int stdout_fd; // write end of the pipe to the next command, or -1
+	pid_t pgid;    // process group to join, 0 to lead a new one, -1 to
+	               // stay in the shell's process group
+};
+
+// Stored by spawn_pipeline() if no process could be created at all.
+#define SPAWN_ERROR -1
+
+// Stored by spawn_pipeline() if the process could not be started because
+// a redirection or the exec itself failed. The caller should treat this the
+// same as a child that exited with a value of 1.
+#define SPAWN_CHILD_ERROR -2
+
+void select_spawn_engine(const char* name);
+void select_pipe_size(const char* size);
+void child_signals(int background);
+void exec_child(char** args, const char* path, int background) __attribute__((noreturn));
+int open_stdin_data(const char* data);
+int count_stages(struct command_info* command);
+int spawn_pipeline(struct command_info* command, int background, pid_t* pids);
+
+#endif // __SPAWN_ENGINE_H__
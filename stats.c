@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "stats.h"
+
+#ifndef NO_STATS
+
+// Number of histogram buckets. Bucket i counts durations of at least 2^(i-1)
+// and less than 2^i nanoseconds, bucket 0 counts durations of 0 ns.
+#define NUM_BUCKETS 65
+
+// Latency histogram of one phase. Recording a duration is a clock read, a
+// count-leading-zeros and a few additions, with no allocation.
+struct histogram {
+	uint64_t buckets[NUM_BUCKETS];
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+};
+
+static struct histogram histograms[NUM_STAT_PHASES];
+
+static const char* phase_names[NUM_STAT_PHASES] = {
+	"read", "parse", "spawn", "wait", "reap", "command"
+};
+
+void record_stat(enum stat_phase phase, const struct timespec* start){
+/*
+Adds the time since start to the histogram of a phase. Called through the
+STAT_END macro.
+
+Receives: -enum stat_phase phase: The phase that ended.
+          -const struct timespec* start: CLOCK_MONOTONIC time it started.
+Returns: Nothing
+*/
+	struct histogram* hist = &histograms[phase];
+	struct timespec end;
+	uint64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (uint64_t) (end.tv_sec - start->tv_sec) * 1000000000 + end.tv_nsec - start->tv_nsec;
+
+	hist->buckets[ns ? 64 - __builtin_clzll(ns) : 0]++;
+	hist->count++;
+	hist->total_ns += ns;
+	if (ns > hist->max_ns)
+		hist->max_ns = ns;
+}
+
+static uint64_t percentile(struct histogram* hist, double p){
+/*
+Estimates a percentile from a histogram, as the upper bound of the bucket
+it falls in, so it is never below the real value and at most 2x above it.
+
+Receives: -struct histogram* hist: The histogram.
+          -double p: The percentile, between 0 and 1.
+Returns: uint64_t: The estimate in nanoseconds.
+*/
+	uint64_t rank = (uint64_t) (p * hist->count);
+	uint64_t seen = 0;
+	int i;
+
+	for (i = 0; i < NUM_BUCKETS; i++)
+	{
+		seen += hist->buckets[i];
+		if (seen > rank)
+			break;
+	}
+
+	if (i == 0)
+		return 0;
+	if (i >= 63 || ((uint64_t) 1 << i) > hist->max_ns)
+		return hist->max_ns;
+	return (uint64_t) 1 << i;
+}
+
+#endif // NO_STATS
+
+void print_stats(void){
+/*
+Built in "stats" command. Prints the number of samples and the mean, p50,
+p99 and max latency of every phase, in microseconds.
+
+Receives: Nothing
+Returns: Nothing
+*/
+#ifdef NO_STATS
+	printf("stats: built without instrumentation\n");
+	fflush(stdout);
+#else
+	struct histogram* hist;
+	int i;
+
+	printf("%-8s %10s %10s %10s %10s %10s\n", "phase", "count", "mean_us", "p50_us",
+		"p99_us", "max_us");
+	for (i = 0; i < NUM_STAT_PHASES; i++)
+	{
+		hist = &histograms[i];
+		if (hist->count == 0)
+		{
+			printf("%-8s %10d %10s %10s %10s %10s\n", phase_names[i], 0, "-", "-", "-", "-");
+			continue;
+		}
+
+		printf("%-8s %10llu %10.1f %10.1f %10.1f %10.1f\n", phase_names[i],
+			(unsigned long long) hist->count,
+			hist->total_ns / 1000.0 / hist->count,
+			percentile(hist, 0.5) / 1000.0,
+			percentile(hist, 0.99) / 1000.0,
+			hist->max_ns / 1000.0);
+	}
+	fflush(stdout);
+#endif // NO_STATS
+}
+
+void reset_stats(void){
+/*
+Clears every histogram. Used by "stats -r".
+
+Receives: Nothing
+Returns: Nothing
+*/
+#ifndef NO_STATS
+	memset(histograms, 0, sizeof(histograms));
+#endif
+}
@@ -0,0 +1,41 @@
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <time.h>
+
+// Phases of running a command whose latency is recorded.
+enum stat_phase {
+	STAT_READ,    // arg_str(): getting the command line from the input buffer
+	STAT_PARSE,   // tokenize()
+	STAT_SPAWN,   // creating one process (fork, or posix_spawn up to exec)
+	STAT_WAIT,    // waiting for a foreground job to terminate
+	STAT_REAP,    // cleaning up and reporting a background process
+	STAT_COMMAND, // an external command, from starting its pipeline until it
+	              // is done (foreground) or started (background)
+	NUM_STAT_PHASES
+};
+
+// Building with -DNO_STATS removes the instrumentation completely: the
+// macros expand to nothing and the stats builtin reports that it is off.
+#ifndef NO_STATS
+
+#define STAT_START(name) \
+	struct timespec name; \
+	clock_gettime(CLOCK_MONOTONIC, &name)
+
+#define STAT_END(phase, name) record_stat(phase, &name)
+
+#else
+
+#define STAT_START(name)
+#define STAT_END(phase, name)
+
+#endif // NO_STATS
+
+#ifndef NO_STATS
+void record_stat(enum stat_phase phase, const struct timespec* start);
+#endif
+void print_stats(void);
+void reset_stats(void);
+
+#endif // __STATS_H__
@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "trace.h"
+#include "command_info.h"
+
+// Trace of every process the shell runs, written as JSON lines to the file
+// in SMALLSH_TRACE. Two records are written per process: "spawn" when it is
+// started and "exit" when it is cleaned up, joined by pid. Times are
+// CLOCK_REALTIME in microseconds.
+//
+// Records are formatted by the shell and copied into a ring buffer, and a
+// writer thread moves them to the file. The shell never waits for the file:
+// if the ring is full because the file is slow, the record is dropped and
+// counted instead.
+
+// Size of the ring buffer. Must be a power of two.
+#define RING_SIZE (1 << 20)
+
+// Longest record. Longer argv lists are cut short.
+#define MAX_RECORD 4096
+
+static int trace_fd = -1;
+static char* ring = NULL;
+static size_t ring_head = 0;  // total bytes added, only grows
+static size_t ring_tail = 0;  // total bytes written to the file
+static unsigned long dropped = 0;
+static int closing = 0;
+
+// The shell that started the writer thread. A forked child that exits
+// before exec has no writer thread to stop.
+static pid_t trace_owner = 0;
+
+static pthread_t writer;
+static pthread_mutex_t ring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ring_ready = PTHREAD_COND_INITIALIZER;
+
+static void* write_trace(void* arg){
+/*
+Writer thread. Waits for records in the ring buffer and writes them to the
+trace file, as many as are available in one write() at a time. Exits once
+close_trace() was called and the ring is empty.
+
+Receives: void* arg: Unused.
+Returns: void*: NULL
+*/
+	size_t start;
+	size_t len;
+	ssize_t written;
+
+	(void) arg;
+	pthread_mutex_lock(&ring_lock);
+	while (1)
+	{
+		while (ring_head == ring_tail && !closing)
+			pthread_cond_wait(&ring_ready, &ring_lock);
+		if (ring_head == ring_tail)
+			break;
+
+		// Write up to the end of the buffer, the rest on the next pass.
+		start = ring_tail & (RING_SIZE - 1);
+		len = ring_head - ring_tail;
+		if (len > RING_SIZE - start)
+			len = RING_SIZE - start;
+		pthread_mutex_unlock(&ring_lock);
+
+		written = write(trace_fd, ring + start, len);
+
+		pthread_mutex_lock(&ring_lock);
+		if (written <= 0)
+			written = len;  // the trace is best effort, skip what failed
+		ring_tail += written;
+	}
+	pthread_mutex_unlock(&ring_lock);
+
+	return NULL;
+}
+
+void open_trace(const char* path){
+/*
+Starts tracing to a file, if SMALLSH_TRACE is set. Called once at the
+start of main. Records are appended, so several shells can share a file.
+
+Receives: const char* path: Value of SMALLSH_TRACE, or NULL to not trace.
+Returns: Nothing
+*/
+	sigset_t all_signals;
+	sigset_t old_mask;
+
+	if (path == NULL || *path == '\0')
+		return;
+
+	trace_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0660);
+	if (trace_fd == -1)
+	{
+		perror(path);
+		return;
+	}
+	if ((ring = malloc(RING_SIZE)) == NULL)
+	{
+		perror("trace");
+		close(trace_fd);
+		trace_fd = -1;
+		return;
+	}
+	trace_owner = getpid();
+
+	// The writer thread blocks every signal, so they keep going to the
+	// main thread (SIGTSTP) and its signalfd (SIGCHLD).
+	sigfillset(&all_signals);
+	pthread_sigmask(SIG_SETMASK, &all_signals, &old_mask);
+	if (pthread_create(&writer, NULL, write_trace, NULL) != 0)
+	{
+		close(trace_fd);
+		trace_fd = -1;
+	}
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	// Flush what is left when the shell exits.
+	atexit(close_trace);
+}
+
+void close_trace(void){
+/*
+Waits for the writer thread to write out the ring buffer and stops it.
+Called when the shell exits.
+
+Receives: Nothing
+Returns: Nothing
+*/
+	char record[64];
+	int len;
+
+	if (trace_fd == -1 || getpid() != trace_owner)
+		return;
+
+	pthread_mutex_lock(&ring_lock);
+	closing = 1;
+	pthread_cond_signal(&ring_ready);
+	pthread_mutex_unlock(&ring_lock);
+	pthread_join(writer, NULL);
+
+	if (dropped > 0)
+	{
+		len = snprintf(record, sizeof(record), "{\"event\":\"dropped\",\"count\":%lu}\n", dropped);
+		write(trace_fd, record, len);
+	}
+
+	close(trace_fd);
+	trace_fd = -1;
+}
+
+static void add_record(const char* record, size_t len){
+/*
+Copies a record into the ring buffer and wakes up the writer thread, or
+drops it if the ring is full.
+
+Receives: -const char* record: The record, ending with a newline.
+          -size_t len: Its length.
+Returns: Nothing
+*/
+	size_t start;
+	size_t first;
+
+	pthread_mutex_lock(&ring_lock);
+	if (RING_SIZE - (ring_head - ring_tail) < len)
+	{
+		dropped++;
+		pthread_mutex_unlock(&ring_lock);
+		return;
+	}
+
+	start = ring_head & (RING_SIZE - 1);
+	first = (len < RING_SIZE - start) ? len : RING_SIZE - start;
+	memcpy(ring + start, record, first);
+	memcpy(ring, record + first, len - first);
+	ring_head += len;
+
+	pthread_cond_signal(&ring_ready);
+	pthread_mutex_unlock(&ring_lock);
+}
+
+static size_t add_string(char* buffer, size_t len, const char* string){
+/*
+Appends a string to a record as a quoted JSON string.
+
+Receives: -char* buffer: The record, MAX_RECORD bytes.
+          -size_t len: Current length of the record.
+          -const char* string: The string to add.
+Returns: size_t: The new length. Stops short if the record is full.
+*/
+	// Leave room for the escape, the closing quote and the end of the record.
+	size_t limit = MAX_RECORD - 64;
+
+	buffer[len++] = '"';
+	for (; *string != '\0' && len < limit; string++)
+	{
+		if (*string == '"' || *string == '\\')
+		{
+			buffer[len++] = '\\';
+			buffer[len++] = *string;
+		}
+		else if ((unsigned char) *string < 0x20)
+			len += sprintf(buffer + len, "\\u%04x", *string);
+		else
+			buffer[len++] = *string;
+	}
+	buffer[len++] = '"';
+
+	return len;
+}
+
+static long long micros(const struct timespec* time){
+	return (long long) time->tv_sec * 1000000 + time->tv_nsec / 1000;
+}
+
+void trace_spawn(struct command_info* command, pid_t pid, int background,
+	const struct timespec* fork_time, const struct timespec* exec_time){
+/*
+Records that a process was started.
+
+Receives: -struct command_info* command: The command, for argv and its
+           redirections.
+          -pid_t pid: The new process.
+          -int background: 1 for a background job.
+          -const struct timespec* fork_time: CLOCK_REALTIME time the spawn
+           started.
+          -const struct timespec* exec_time: CLOCK_REALTIME time the spawn
+           returned. With posix_spawn, the child has exec'd by then.
+Returns: Nothing
+*/
+	char record[MAX_RECORD];
+	size_t len;
+	int i;
+
+	if (trace_fd == -1)
+		return;
+
+	len = snprintf(record, sizeof(record),
+		"{\"event\":\"spawn\",\"pid\":%d,\"bg\":%s,\"fork_us\":%lld,\"exec_us\":%lld,\"argv\":[",
+		pid, background ? "true" : "false", micros(fork_time), micros(exec_time));
+
+	for (i = 0; command->args[i] != NULL && len < MAX_RECORD - 64; i++)
+	{
+		if (i > 0)
+			record[len++] = ',';
+		len = add_string(record, len, command->args[i]);
+	}
+	record[len++] = ']';
+
+	if (command->stdin_file != NULL && len < MAX_RECORD - 64)
+	{
+		len += sprintf(record + len, ",\"stdin\":");
+		len = add_string(record, len, command->stdin_file);
+	}
+	if (command->stdout_file != NULL && len < MAX_RECORD - 64)
+	{
+		len += sprintf(record + len, ",\"stdout\":");
+		len = add_string(record, len, command->stdout_file);
+	}
+
+	record[len++] = '}';
+	record[len++] = '\n';
+	add_record(record, len);
+}
+
+void trace_exit(pid_t pid, int wstatus){
+/*
+Records that a process was cleaned up, with its exit value or the signal
+that terminated it.
+
+Receives: -pid_t pid: The process.
+          -int wstatus: Its status from waitpid().
+Returns: Nothing
+*/
+	char record[128];
+	struct timespec now;
+	int len;
+
+	if (trace_fd == -1)
+		return;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	len = snprintf(record, sizeof(record), "{\"event\":\"exit\",\"pid\":%d,\"exit_us\":%lld,\"%s\":%d}\n",
+		pid, micros(&now),
+		WIFEXITED(wstatus) ? "status" : "signal",
+		WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : WTERMSIG(wstatus));
+	add_record(record, len);
+}
@@ -0,0 +1,14 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <sys/types.h>
+#include <time.h>
+#include "command_info.h"
+
+void open_trace(const char* path);
+void close_trace(void);
+void trace_spawn(struct command_info* command, pid_t pid, int background,
+	const struct timespec* fork_time, const struct timespec* exec_time);
+void trace_exit(pid_t pid, int wstatus);
+
+#endif // __TRACE_H__
@@ -0,0 +1,508 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sched.h>
+#include <errno.h>
+#include "zygote.h"
+#include "spawn_engine.h"
+#include "command_info.h"
+#include "placement.h"
+#include "proc_subst.h"
+
+// The zygote is a small helper process forked when the shell starts, before
+// it has built up any state. It receives spawn requests over a socketpair
+// and creates the children from its own small address space, so the cost
+// of creating a child does not grow with the shell. The children are
+// created with CLONE_PARENT, which makes them children of the shell, so
+// they are waited for and watched like any other child.
+
+// Most fds a request can pass: the shell's stdin, stdout and stderr, the
+// stdin and stdout of the child and its process substitutions.
+#define MAX_ZYGOTE_FDS 64
+
+// Fixed part of a spawn request. The fds are passed with it as SCM_RIGHTS,
+// followed by args_len bytes of strings: the args, then the path if
+// has_path is set.
+struct zygote_request {
+	int background;                // 1 for a background process
+	pid_t pgid;                    // process group, as in struct spawn_io
+	int has_placement;             // 1 if placement is set
+	struct placement placement;    // placement of the job (text is unused)
+	int num_fds;                   // number of fds passed
+	int targets[MAX_ZYGOTE_FDS];   // fd number each one gets in the child
+	int num_args;                  // number of args
+	int has_path;                  // 1 if a cached path follows the args
+	size_t args_len;               // bytes of strings after the request
+};
+
+// Shell's end of the socketpair, -1 if there is no zygote.
+static int zygote_fd = -1;
+
+// pid of the zygote, waited for once it has gone away.
+static pid_t zygote_pid = -1;
+
+static int read_full(int fd, void* buffer, size_t size){
+/*
+Reads exactly size bytes from a socket, retrying after short reads and
+signals.
+
+Receives: -int fd: The socket.
+          -void* buffer: Where the bytes are stored.
+          -size_t size: Number of bytes.
+Returns: int: 0 if successful, -1 at end of file or on an error.
+*/
+	ssize_t result;
+
+	while (size > 0)
+	{
+		result = read(fd, buffer, size);
+		if (result == -1 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return -1;
+		buffer = (char*) buffer + result;
+		size -= result;
+	}
+
+	return 0;
+}
+
+static int write_full(int fd, const void* buffer, size_t size){
+/*
+Writes exactly size bytes to a socket, without raising SIGPIPE if the
+other end is gone.
+
+Receives: -int fd: The socket.
+          -const void* buffer: The bytes.
+          -size_t size: Number of bytes.
+Returns: int: 0 if successful, -1 on an error.
+*/
+	ssize_t result;
+
+	while (size > 0)
+	{
+		result = send(fd, buffer, size, MSG_NOSIGNAL);
+		if (result == -1 && errno == EINTR)
+			continue;
+		if (result == -1)
+			return -1;
+		buffer = (const char*) buffer + result;
+		size -= result;
+	}
+
+	return 0;
+}
+
+static void zygote_child(struct zygote_request* request, int* fds, char** args, const char* path){
+/*
+Runs in a new child of the zygote. Sets up the child like the fork engine
+does, moves the passed fds to their numbers and executes the command.
+
+Receives: -struct zygote_request* request: The request.
+          -int* fds: The fds passed with it.
+          -char** args: The command and its args.
+          -const char* path: Cached path of the program, or NULL.
+Returns: Nothing
+*/
+	struct sigaction default_action = {0};
+	int base = 3;
+	int high;
+	int i;
+
+	// The zygote ignores SIGQUIT, which the shell does not, so restore it
+	// like the posix and fork engines leave it.
+	default_action.sa_handler = SIG_DFL;
+	sigaction(SIGQUIT, &default_action, NULL);
+	child_signals(request->background);
+
+	if (request->pgid != -1)
+		setpgid(0, request->pgid);
+
+	if (request->has_placement && apply_placement(&request->placement) == -1)
+		exit(1);
+
+	// Move the fds out of the way of every target first, so that moving
+	// one to its target can't close another. The copies are closed by exec.
+	for (i = 0; i < request->num_fds; i++)
+	{
+		if (request->targets[i] >= base)
+			base = request->targets[i] + 1;
+	}
+	for (i = 0; i < request->num_fds; i++)
+	{
+		high = fcntl(fds[i], F_DUPFD_CLOEXEC, base);
+		close(fds[i]);
+		fds[i] = high;
+	}
+
+	// Later fds win, so a redirection replaces a pipe, which replaces the
+	// shell's own stdin or stdout.
+	for (i = 0; i < request->num_fds; i++)
+		dup2(fds[i], request->targets[i]);
+
+	exec_child(args, path, request->background);
+}
+
+static void zygote_loop(int fd){
+/*
+Main loop of the zygote. Serves spawn requests until the shell closes its
+end of the socket, replying to each with the pid of the new child, or -1.
+
+Receives: int fd: The zygote's end of the socketpair.
+Returns: Nothing
+*/
+	struct zygote_request request;
+	char control[CMSG_SPACE(MAX_ZYGOTE_FDS * sizeof(int))];
+	struct msghdr message;
+	struct cmsghdr* header;
+	struct iovec iov;
+	char discard[256];
+	char* strings;
+	char* path;
+	size_t skip;
+	size_t chunk;
+	ssize_t result;
+	pid_t pid;
+	int fds[MAX_ZYGOTE_FDS];
+	int num_fds;
+	int i;
+
+	while (1)
+	{
+		// The fds arrive with the first byte of the request.
+		memset(&message, 0, sizeof(message));
+		iov.iov_base = &request;
+		iov.iov_len = sizeof(request);
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		result = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+		if (result == -1 && errno == EINTR)
+			continue;
+		if (result <= 0)
+			return;
+		if ((size_t) result < sizeof(request)
+			&& read_full(fd, (char*) &request + result, sizeof(request) - result) == -1)
+			return;
+
+		num_fds = 0;
+		header = CMSG_FIRSTHDR(&message);
+		if (header != NULL && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+		{
+			num_fds = (header->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			memcpy(fds, CMSG_DATA(header), num_fds * sizeof(int));
+		}
+
+		// Without memory for the strings, they are read and dropped so the
+		// next request starts at the right byte, and the request fails.
+		if ((strings = malloc(request.args_len)) == NULL)
+		{
+			for (skip = request.args_len; skip > 0; skip -= chunk)
+			{
+				chunk = (skip < sizeof(discard)) ? skip : sizeof(discard);
+				if (read_full(fd, discard, chunk) == -1)
+					return;
+			}
+			for (i = 0; i < num_fds; i++)
+				close(fds[i]);
+			pid = -1;
+			if (write_full(fd, &pid, sizeof(pid)) == -1)
+				return;
+			continue;
+		}
+
+		char* args[request.num_args + 1];
+		if (read_full(fd, strings, request.args_len) == -1)
+			return;
+
+		path = strings;
+		for (i = 0; i < request.num_args; i++)
+		{
+			args[i] = path;
+			path += strlen(path) + 1;
+		}
+		args[request.num_args] = NULL;
+		if (!request.has_path)
+			path = NULL;
+
+		// CLONE_PARENT makes the child a child of the shell, which gets its
+		// SIGCHLD and waits for it.
+		if (num_fds != request.num_fds)
+			pid = -1;
+		else if ((pid = syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0)) == 0)
+			zygote_child(&request, fds, args, path);
+
+		for (i = 0; i < num_fds; i++)
+			close(fds[i]);
+		free(strings);
+
+		if (write_full(fd, &pid, sizeof(pid)) == -1)
+			return;
+	}
+}
+
+int start_zygote(void){
+/*
+Forks the zygote. Called once, when the zygote engine is selected at the
+start of main, while the shell is still small.
+
+Receives: Nothing
+Returns: int: 0 if successful, -1 if the zygote could not be started.
+*/
+	struct sigaction ignore_action = {0};
+	int fds[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+		return -1;
+
+	switch ((zygote_pid = fork()))
+	{
+		case -1:
+			close(fds[0]);
+			close(fds[1]);
+			return -1;
+
+		// The zygote stays in the shell's process group, so it ignores the
+		// terminal's signals. Its children set their own dispositions.
+		case 0:
+			close(fds[0]);
+			ignore_action.sa_handler = SIG_IGN;
+			sigaction(SIGINT, &ignore_action, NULL);
+			sigaction(SIGTSTP, &ignore_action, NULL);
+			sigaction(SIGQUIT, &ignore_action, NULL);
+			zygote_loop(fds[1]);
+			_exit(0);
+
+		default:
+			close(fds[1]);
+			zygote_fd = fds[0];
+			return 0;
+	}
+}
+
+int zygote_running(void){
+/*
+Checks if the zygote can take requests.
+
+Receives: Nothing
+Returns: int: 1 if it can, 0 if it was never started or has gone away.
+*/
+	return zygote_fd != -1;
+}
+
+static int add_fd(struct zygote_request* request, int* fds, int fd, int target){
+/*
+Adds an fd to a request.
+
+Receives: -struct zygote_request* request: The request.
+          -int* fds: The fds of the request.
+          -int fd: The fd in the shell.
+          -int target: The fd number it gets in the child.
+Returns: int: 0 if successful, -1 if the request has no room left.
+*/
+	if (request->num_fds == MAX_ZYGOTE_FDS)
+		return -1;
+	fds[request->num_fds] = fd;
+	request->targets[request->num_fds++] = target;
+	return 0;
+}
+
+pid_t zygote_spawn(struct command_info* command, int background, struct spawn_io* io,
+	const char* path, const struct placement* placement){
+/*
+Launches a child through the zygote. The redirection files are opened here
+and passed to the zygote with the pipe ends, the shell's stdin, stdout and
+stderr and the fds of process substitutions, so the child gets the same
+fds as from the fork engine. If the zygote has gone away, it is marked as
+not running and reaped. If that happened before it got the whole request,
+ZYGOTE_NOT_SENT is returned so the caller can start the command with
+another engine.
+
+Receives: -struct command_info* command: Pointer to struct with information
+           for command (args, i/o redirection files).
+          -int background: 1 if the child is a background process, 0 if not.
+          -struct spawn_io* io: Pipe ends and process group for the child.
+          -const char* path: Path of the program from the PATH cache, or
+           NULL to search PATH.
+          -const struct placement* placement: Placement of the job, or NULL.
+
+Returns: pid of the child, SPAWN_CHILD_ERROR if a redirection failed,
+         ZYGOTE_NOT_SENT if the request never reached the zygote, or
+         SPAWN_ERROR if the zygote could not create the child or went away
+         after the request.
+*/
+	struct zygote_request request = {0};
+	char control[CMSG_SPACE(MAX_ZYGOTE_FDS * sizeof(int))] = {0};
+	struct msghdr message = {0};
+	struct cmsghdr* header;
+	struct proc_subst* subst;
+	struct iovec iov;
+	char* strings;
+	char* end;
+	pid_t pid = SPAWN_ERROR;
+	int fds[MAX_ZYGOTE_FDS];
+	int infile = -1;
+	int outfile = -1;
+	int failed = 0;
+	int sent;
+	int i;
+
+	request.background = background;
+	request.pgid = io->pgid;
+	if (placement != NULL)
+	{
+		request.has_placement = 1;
+		request.placement = *placement;
+		request.placement.text = NULL;
+	}
+
+	// The shell's own stdin, stdout and stderr, which may be redirected by
+	// a builtin, then process substitutions, pipes and redirections.
+	for (i = 0; i < 3; i++)
+		add_fd(&request, fds, i, i);
+	for (subst = command->subst; subst != NULL; subst = subst->next)
+	{
+		if (subst->fd != -1)
+			failed |= add_fd(&request, fds, subst->fd, subst->fd);
+	}
+	if (io->stdin_fd != -1)
+		failed |= add_fd(&request, fds, io->stdin_fd, 0);
+	if (io->stdout_fd != -1)
+		failed |= add_fd(&request, fds, io->stdout_fd, 1);
+
+	// Background processes without a redirect or pipe use /dev/null.
+	if (command->stdin_file != NULL)
+		infile = open(command->stdin_file, O_RDONLY | O_CLOEXEC);
+	else if (background && io->stdin_fd == -1)
+		infile = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if ((command->stdin_file != NULL || (background && io->stdin_fd == -1)) && infile == -1)
+	{
+		if (!background)
+		{
+			printf("Error opening file for stdin redirection\n");
+			fflush(stdout);
+		}
+		return SPAWN_CHILD_ERROR;
+	}
+
+	if (command->stdout_file != NULL)
+		outfile = open(command->stdout_file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0660);
+	else if (background && io->stdout_fd == -1)
+		outfile = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if ((command->stdout_file != NULL || (background && io->stdout_fd == -1)) && outfile == -1)
+	{
+		if (!background)
+		{
+			printf("open: %s: %s\n", command->stdout_file, strerror(errno));
+			fflush(stdout);
+		}
+		if (infile != -1)
+			close(infile);
+		return SPAWN_CHILD_ERROR;
+	}
+
+	if (infile != -1)
+		failed |= add_fd(&request, fds, infile, 0);
+	if (outfile != -1)
+		failed |= add_fd(&request, fds, outfile, 1);
+
+	if (failed)
+	{
+		printf("%s: too many open files for the zygote\n", command->args[0]);
+		fflush(stdout);
+		if (infile != -1)
+			close(infile);
+		if (outfile != -1)
+			close(outfile);
+		return SPAWN_CHILD_ERROR;
+	}
+
+	// The args and path are sent as one block of strings.
+	for (i = 0; command->args[i] != NULL; i++)
+		request.args_len += strlen(command->args[i]) + 1;
+	request.num_args = i;
+	if (path != NULL)
+	{
+		request.has_path = 1;
+		request.args_len += strlen(path) + 1;
+	}
+
+	if ((strings = malloc(request.args_len)) == NULL)
+	{
+		perror("malloc");
+		fflush(stdout);
+		if (infile != -1)
+			close(infile);
+		if (outfile != -1)
+			close(outfile);
+		return SPAWN_ERROR;
+	}
+	end = strings;
+	for (i = 0; command->args[i] != NULL; i++)
+		end = stpcpy(end, command->args[i]) + 1;
+	if (path != NULL)
+		stpcpy(end, path);
+
+	iov.iov_base = &request;
+	iov.iov_len = sizeof(request);
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = CMSG_SPACE(request.num_fds * sizeof(int));
+	header = CMSG_FIRSTHDR(&message);
+	header->cmsg_level = SOL_SOCKET;
+	header->cmsg_type = SCM_RIGHTS;
+	header->cmsg_len = CMSG_LEN(request.num_fds * sizeof(int));
+	memcpy(CMSG_DATA(header), fds, request.num_fds * sizeof(int));
+
+	// The request is the first bytes sent, so it carries the fds. The
+	// zygote only starts the child once it has the whole request.
+	errno = 0;
+	while ((i = sendmsg(zygote_fd, &message, MSG_NOSIGNAL)) == -1 && errno == EINTR)
+		continue;
+	sent = !(i == -1 || (i < (int) sizeof(request)
+			&& write_full(zygote_fd, (char*) &request + i, sizeof(request) - i) == -1)
+		|| write_full(zygote_fd, strings, request.args_len) == -1);
+	if (!sent || read_full(zygote_fd, &pid, sizeof(pid)) == -1)
+	{
+		printf("zygote: %s\n", errno ? strerror(errno) : "connection closed");
+		fflush(stdout);
+		close(zygote_fd);
+		zygote_fd = -1;
+
+		// Once the whole request was sent, the zygote may have started
+		// the child before it went away, so the command must not run again.
+		pid = sent ? SPAWN_ERROR : ZYGOTE_NOT_SENT;
+
+		// The zygote is a child of the shell. Make sure it is gone and
+		// clean it up, so it does not stay a zombie.
+		kill(zygote_pid, SIGKILL);
+		waitpid(zygote_pid, NULL, 0);
+		zygote_pid = -1;
+	}
+	free(strings);
+
+	if (pid == -1)
+		pid = SPAWN_ERROR;
+
+	// Also set the process group from the parent, as the fork engine does.
+	else if (pid > 0 && io->pgid != -1)
+		setpgid(pid, io->pgid ? io->pgid : pid);
+
+	if (infile != -1)
+		close(infile);
+	if (outfile != -1)
+		close(outfile);
+	return pid;
+}
@@ -0,0 +1,20 @@
+#ifndef __ZYGOTE_H__
+#define __ZYGOTE_H__
+
+#include <sys/types.h>
+#include "command_info.h"
+#include "spawn_engine.h"
+
+struct placement;
+
+// Returned by zygote_spawn() if the zygote went away before it got the
+// whole request, so the child was never created and can be started by
+// another engine.
+#define ZYGOTE_NOT_SENT -3
+
+int start_zygote(void);
+int zygote_running(void);
+pid_t zygote_spawn(struct command_info* command, int background, struct spawn_io* io,
+	const char* path, const struct placement* placement);
+
+#endif // __ZYGOTE_H__